@@ -381,15 +381,20 @@ int main()
 
 	// 准备正射投影 纹理数据 也就是真实相机捕获的图像
 	// texture preparation
+	// 纹理只创建一次, 帧尺寸变化时才重新分配存储
+	// created once, storage is (re)allocated only when the frame size changes
 	unsigned int texture;
+	int texture_width = 0, texture_height = 0;
 	glGenTextures(1, &texture);
 	glBindTexture(GL_TEXTURE_2D, texture); // all upcoming GL_TEXTURE_2D operations now have effect on this texture object
 										   // set the texture wrapping parameters
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);	// set texture wrapping to GL_REPEAT (default wrapping method)
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	// set texture filtering parameters
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	// set texture filtering parameters, no mipmaps: the frame is drawn 1:1
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
 	// render loop
 	// -----------
@@ -409,10 +414,16 @@ int main()
 		detectArucoMarkers(frame);
 		cv::flip(frame, frame, 0);
 		
-		// 生成纹理
-		// gen texture from camera capture data
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, frame.cols, frame.rows, 0, GL_BGR, GL_UNSIGNED_BYTE, frame.data);
-		glGenerateMipmap(GL_TEXTURE_2D);
+		// 更新纹理
+		// update the texture from camera capture data
+		glBindTexture(GL_TEXTURE_2D, texture);
+		if (frame.cols != texture_width || frame.rows != texture_height)
+		{
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, frame.cols, frame.rows, 0, GL_BGR, GL_UNSIGNED_BYTE, NULL);
+			texture_width = frame.cols;
+			texture_height = frame.rows;
+		}
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, frame.cols, frame.rows, GL_BGR, GL_UNSIGNED_BYTE, frame.data);
 
 		// render
 		glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
@@ -469,6 +480,7 @@ int main()
 
 	glDeleteVertexArrays(1, &VAO);
 	glDeleteBuffers(1, &VBO);
+	glDeleteTextures(1, &texture);
 
 	// glfw: terminate, clearing all previously allocated GLFW resources.
 	// ------------------------------------------------------------------
@@ -7,6 +7,7 @@
 #include <opencv2\core.hpp>
 
 #include "shader.h"
+#include "streaming_texture.h"
 
 #include <string>
 #include <fstream>
@@ -42,18 +43,8 @@ public:
 
 	void Draw(cv::Mat &frame)
 	{
-		unsigned int texture;
-		glGenTextures(1, &texture);
-		glBindTexture(GL_TEXTURE_2D, texture);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, frame.cols, frame.rows, 0, GL_BGR, GL_UNSIGNED_BYTE, frame.data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glBindTexture(GL_TEXTURE_2D, texture);
+		// one texture for the lifetime of the mesh, only the pixels change (issue#2)
+		texture.update(frame);
 
 		glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -66,6 +57,7 @@ public:
 
 private:
 	unsigned int VBO, EBO;
+	StreamingTexture texture;
 
 	void setupMesh() 
 	{
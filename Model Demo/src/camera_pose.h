@@ -7,12 +7,31 @@
 #include <opencv2\imgproc.hpp>
 #include <opencv2\calib3d.hpp>
 #include <opencv2\features2d.hpp>
-#include <opencv2\xfeatures2d.hpp>
+#include <opencv2\video.hpp>
 
 #include <iostream>
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+
+#include "feature_engine.h"
+#include "vocabulary_tree.h"
+#include "planar_pose.h"
 
 using namespace cv;
 
+struct MarkerlessTarget
+{
+	String path;
+	Size size;
+	double width, height;//ʵʳߴ
+	std::vector<KeyPoint> keypoints;
+	Mat descriptors;
+	Ptr<DescriptorMatcher> matcher;
+	uint64_t key;//ͼĹϣ
+	Ptr<MappedFile> mapping;//ʱֱָӳڴ
+};
+
 class CameraPose
 {
 public:
@@ -26,13 +45,16 @@ public:
 	void pose_estimate(Mat &in);
 	void marker_based(Mat &in);
 	void markerless(cv::Mat &in);
+	bool markerless_detect(cv::Mat &in);
+	bool markerless_track();
+	bool homography_pose(const Mat &H);
+	int addTarget(const String &path, double width = 1.0, double height = 0);
 
 	CameraPose(bool, String, String);
 	~CameraPose();
 
 private:
 	float markerLength = 1.75;
-	int minHessian = 400;
 
 	Mat camera_matrix;
 	Mat dist_coeffs;
@@ -42,10 +64,47 @@ private:
 	std::vector< int > markerIds;
 	std::vector< std::vector<cv::Point2f> > markerCorners, rejectedCandidates;
 	
-	Mat img_object;
-	Mat descriptors_object;
-	std::vector<KeyPoint> keypoints_object;
-	Ptr<cv::xfeatures2d::SURF> detector;
+	String featureName, matcherName;
+	Ptr<FeatureEngine> features;
+
+	//Ŀʶ
+	std::vector<String> targetPaths;
+	std::vector<MarkerlessTarget> targets;
+	VocabularyTree vocabulary;
+	std::vector<int> candidates;
+	int maxCandidates = 4;
+	int activeTarget = 0;
+	TickMeter recognitionTimer;
+	bool useCache = true;
+	int cacheHits = 0;
+	int gridCols = 1, gridRows = 1, gridOverlap = 32;
+	bool benchmarkPending = false;
+
+	//Ӧֱӷֽλ
+	std::vector<double> targetSizes;
+	PlanarPose planarPose;
+	TickMeter poseTimer;
+	bool checkPose = false;
+	double maxRotationError = 0, maxTranslationError = 0;
+
+	std::vector<KeyPoint> keypoints_scene;
+	Mat descriptors_scene;
+	std::vector<DMatch> good_matches;
+
+	//֡
+	int redetectInterval = 10;
+	float minInlierRatio = 0.5f;
+	bool tracking = false;
+	int framesSinceDetect = 0;
+	size_t trackedAtDetect = 0;
+	Mat gray_scene, prev_gray_scene;
+	std::vector<Point2f> track_obj, track_scene, next_scene;
+	std::vector<uchar> track_status, inlier_mask;
+	std::vector<float> track_err;
+
+	TickMeter markerlessTimer;
+	int markerlessFrames = 0;
+	int markerlessDetects = 0;
 
 };
 
@@ -62,6 +121,30 @@ void CameraPose::readCamParameters(String path)
 
 	fs["camera_matrix"] >> this->camera_matrix;
 	fs["distortion_coefficients"] >> dist_coeffs;
+	fs["markerless_features"] >> this->featureName;
+	fs["markerless_matcher"] >> this->matcherName;
+	if (!fs["markerless_targets"].empty())
+		fs["markerless_targets"] >> this->targetPaths;
+	if (!fs["markerless_candidates"].empty())
+		fs["markerless_candidates"] >> this->maxCandidates;
+	if (!fs["markerless_cache"].empty())
+		this->useCache = (int)fs["markerless_cache"] != 0;
+	if (!fs["markerless_grid_cols"].empty())
+		fs["markerless_grid_cols"] >> this->gridCols;
+	if (!fs["markerless_grid_rows"].empty())
+		fs["markerless_grid_rows"] >> this->gridRows;
+	if (!fs["markerless_grid_overlap"].empty())
+		fs["markerless_grid_overlap"] >> this->gridOverlap;
+	if (!fs["markerless_benchmark"].empty())
+		this->benchmarkPending = (int)fs["markerless_benchmark"] != 0;
+	if (!fs["markerless_target_sizes"].empty())
+		fs["markerless_target_sizes"] >> this->targetSizes;
+	if (!fs["markerless_check_pose"].empty())
+		this->checkPose = (int)fs["markerless_check_pose"] != 0;
+	if (!fs["markerless_redetect_interval"].empty())
+		fs["markerless_redetect_interval"] >> this->redetectInterval;
+	if (!fs["markerless_min_inlier_ratio"].empty())
+		fs["markerless_min_inlier_ratio"] >> this->minInlierRatio;
 
 	std::cout << "camera_matrix\n"
 		<< camera_matrix << std::endl;
@@ -122,33 +205,137 @@ void CameraPose::marker_based(cv::Mat &image) {
 }
 
 void CameraPose::markerless(cv::Mat &img_scene)
+{
+	cvtColor(img_scene, this->gray_scene, COLOR_BGR2GRAY);
+	if (this->benchmarkPending)
+	{
+		if (!this->targets.empty())
+			this->features->benchmark(this->gray_scene, this->targets[0].matcher, getNumberOfCPUs());
+		//ʶӳĿı仯, : ORB  32 ֽڶ, SURF  64 ά
+		VocabularyTree::benchmark(CV_8U, 32);
+		VocabularyTree::benchmark(CV_32F, 64);
+		this->benchmarkPending = false;
+	}
+	this->markerlessTimer.start();
+
+	//ֻڸٶʧ򵽴ʱļƥ
+	bool found = false;
+	if (this->tracking && this->framesSinceDetect < this->redetectInterval)
+		found = this->markerless_track();
+	if (!found)
+	{
+		found = this->markerless_detect(this->gray_scene);
+		this->markerlessDetects++;
+	}
+	this->is_mark = found;
+	std::swap(this->prev_gray_scene, this->gray_scene);
+	this->markerlessTimer.stop();
+
+	//ÿ100֡һ
+	if (++this->markerlessFrames == 100)
+	{
+		double ms = this->markerlessTimer.getTimeMilli() / this->markerlessFrames;
+		std::cout << "[markerless] " << this->features->name() << " " << ms << " ms/frame, " << 1000.0 / ms << " fps, "
+			<< this->markerlessDetects << " full detections";
+		if (this->recognitionTimer.getCounter() > 0)
+			std::cout << ", recognition " << this->recognitionTimer.getTimeMilli() / this->recognitionTimer.getCounter() << " ms over "
+				<< this->vocabulary.targets() << " targets";
+		if (this->poseTimer.getCounter() > 0)
+			std::cout << ", pose " << this->poseTimer.getTimeMicro() / this->poseTimer.getCounter() << " us";
+		if (this->checkPose)
+			std::cout << ", vs solvePnP max " << this->maxRotationError << " deg " << this->maxTranslationError << " units";
+		std::cout << std::endl;
+		this->markerlessTimer.reset();
+		this->recognitionTimer.reset();
+		this->poseTimer.reset();
+		this->maxRotationError = this->maxTranslationError = 0;
+		this->markerlessFrames = 0;
+		this->markerlessDetects = 0;
+	}
+}
+
+// Follows the inliers of the last full detection with pyramidal KLT and refits the homography with
+// RHO, which is much cheaper than detect + match. Gives up when the inliers drop below
+// minInlierRatio of what the detection started with.
+bool CameraPose::markerless_track()
+{
+	calcOpticalFlowPyrLK(this->prev_gray_scene, this->gray_scene, this->track_scene, this->next_scene, this->track_status, this->track_err, Size(21, 21), 3);
+
+	size_t kept = 0;
+	for (size_t i = 0; i < this->next_scene.size(); i++)
+	{
+		if (!this->track_status[i])
+			continue;
+		this->track_obj[kept] = this->track_obj[i];
+		this->next_scene[kept] = this->next_scene[i];
+		kept++;
+	}
+	this->track_obj.resize(kept);
+	this->next_scene.resize(kept);
+
+	size_t min_inliers = std::max<size_t>(20, (size_t)(this->minInlierRatio * this->trackedAtDetect));
+	if (kept < min_inliers)
+	{
+		this->tracking = false;
+		return false;
+	}
+
+	Mat H = findHomography(this->track_obj, this->next_scene, RHO, 3, this->inlier_mask);
+	size_t inliers = 0;
+	for (size_t i = 0; i < kept && !H.empty(); i++)
+	{
+		if (!this->inlier_mask[i])
+			continue;
+		this->track_obj[inliers] = this->track_obj[i];
+		this->next_scene[inliers] = this->next_scene[i];
+		inliers++;
+	}
+	if (H.empty() || inliers < min_inliers)
+	{
+		this->tracking = false;
+		return false;
+	}
+	this->track_obj.resize(inliers);
+	this->next_scene.resize(inliers);
+	std::swap(this->track_scene, this->next_scene);
+	this->framesSinceDetect++;
+
+	//˻ĵӦԽⲻ̬, ٶʧ
+	if (!this->homography_pose(H))
+	{
+		this->tracking = false;
+		return false;
+	}
+	return true;
+}
+
+bool CameraPose::markerless_detect(cv::Mat &img_scene)
 {
 	//㵱ǰ֡
-	std::vector<KeyPoint> keypoints_scene;
-	Mat descriptors_scene;
-	this->detector->detectAndCompute(img_scene, noArray(), keypoints_scene, descriptors_scene);
+	this->features->detect(img_scene, keypoints_scene, descriptors_scene);
 
+	this->tracking = false;
 	if (keypoints_scene.size() <= 0)
-		return;
-	//ƥ
-	Ptr<DescriptorMatcher> matcher = DescriptorMatcher::create(DescriptorMatcher::FLANNBASED);
-	std::vector< std::vector<DMatch> > knn_matches;
-
-	matcher->knnMatch(descriptors_object, descriptors_scene, knn_matches, 2);
+		return false;
 
-	//
-	const float ratio_thresh = 0.75f;
-	std::vector<DMatch> good_matches;
-	for (size_t i = 0; i < knn_matches.size(); i++)
+	//ʻɸѡѡĿ, ֻԺѡ֤
+	if (this->targets.size() > 1)
 	{
-		if (knn_matches[i][0].distance < ratio_thresh * knn_matches[i][1].distance)
-		{
-			good_matches.push_back(knn_matches[i][0]);
-		}
+		this->recognitionTimer.start();
+		this->vocabulary.query(descriptors_scene, this->candidates, this->maxCandidates);
+		this->recognitionTimer.stop();
 	}
+	else
+		this->candidates.assign(this->targets.size(), 0);
 
-	if (good_matches.size() > 20)
+	for (size_t c = 0; c < this->candidates.size(); c++)
 	{
+		const MarkerlessTarget &target = this->targets[this->candidates[c]];
+		//ƥ, ڼĿʱѾ
+		this->features->match(target.matcher, descriptors_scene, good_matches);
+		if (good_matches.size() <= 20)
+			continue;
+
 		//㵥ӦԾ
 		std::vector<Point2f> obj;
 		std::vector<Point2f> scene;
@@ -156,59 +343,90 @@ void CameraPose::markerless(cv::Mat &img_scene)
 		for (size_t i = 0; i < good_matches.size(); i++)
 		{
 			//-- Get the keypoints from the good matches
-			obj.push_back(keypoints_object[good_matches[i].queryIdx].pt);
-			scene.push_back(keypoints_scene[good_matches[i].trainIdx].pt);
+			obj.push_back(target.keypoints[good_matches[i].trainIdx].pt);
+			scene.push_back(keypoints_scene[good_matches[i].queryIdx].pt);
 		}
 
-		Mat H = findHomography(obj, scene, RANSAC);
+		Mat H = findHomography(obj, scene, RANSAC, 3, this->inlier_mask);
+		if (H.empty())
+			continue;
+		this->activeTarget = this->candidates[c];
 
-		std::vector<Point2f> obj_corners(4);
-		obj_corners[0] = Point2f(0, 0);
-		obj_corners[1] = Point2f((float)img_object.cols, 0);
-		obj_corners[2] = Point2f((float)img_object.cols, (float)img_object.rows);
-		obj_corners[3] = Point2f(0, (float)img_object.rows);
+		//ڵΪ֡Ĺٵ
+		this->track_obj.clear();
+		this->track_scene.clear();
+		for (size_t i = 0; i < obj.size(); i++)
+		{
+			if (!this->inlier_mask[i])
+				continue;
+			this->track_obj.push_back(obj[i]);
+			this->track_scene.push_back(scene[i]);
+		}
+		this->trackedAtDetect = this->track_obj.size();
+		this->framesSinceDetect = 0;
+		this->tracking = this->homography_pose(H);
+		return this->tracking;
+	}
+	return false;
+}
 
-		//ӦõӦԾ
-		std::vector<Point2f> scene_corners(4);
-		perspectiveTransform(obj_corners, scene_corners, H);
+// Pose straight from the homography: the reference corners are mapped into the frame and the
+// rectangle of the target's physical size is solved in closed form (see PlanarPose). False if the
+// homography is degenerate; viewMatrix is then left as it was and must not be drawn with.
+bool CameraPose::homography_pose(const Mat &H)
+{
+	const MarkerlessTarget &target = this->targets[this->activeTarget];
+	this->poseTimer.start();
+
+	//ӦõӦԾ
+	const double *h = H.ptr<double>(0);
+	const double obj_corners[4][2] = { { 0, 0 }, { (double)target.size.width, 0 }, { (double)target.size.width, (double)target.size.height }, { 0, (double)target.size.height } };
+	Point2f scene_corners[4];
+	for (int i = 0; i < 4; i++)
+	{
+		double u = obj_corners[i][0], v = obj_corners[i][1];
+		double w = 1.0 / (h[6] * u + h[7] * v + h[8]);
+		scene_corners[i] = Point2f((float)((h[0] * u + h[1] * v + h[2]) * w), (float)((h[3] * u + h[4] * v + h[5]) * w));
+	}
 
+	//̬
+	bool solved = this->planarPose.fromCorners(scene_corners, this->camera_matrix, this->dist_coeffs, target.width, target.height);
+	this->poseTimer.stop();
+	if (!solved)
+		return false;
+
+	if (this->checkPose)
+	{
 		std::vector<Point3f> obj_corners_3d(4);
-		for (size_t i = 0; i < 4; i++)
-			obj_corners_3d[i] = Point3f(obj_corners[i].x / 640.f - 0.5, -obj_corners[i].y / 640.f + 0.5, 0);
-		//̬
+		for (int i = 0; i < 4; i++)
+			obj_corners_3d[i] = Point3f((float)((obj_corners[i][0] / target.size.width - 0.5) * target.width), (float)((0.5 - obj_corners[i][1] / target.size.height) * target.height), 0);
 		cv::Vec3d rvec, tvec;
-		cv::solvePnP(obj_corners_3d, scene_corners, camera_matrix, dist_coeffs, rvec, tvec);
-
-		//ͬmaker-based ͬ
-		viewMatrix = cv::Mat::zeros(4, 4, CV_32F);
-		cv::Mat rot;
-
+		cv::solvePnP(obj_corners_3d, std::vector<Point2f>(scene_corners, scene_corners + 4), camera_matrix, dist_coeffs, rvec, tvec);
+		Mat rot;
 		Rodrigues(rvec, rot);
-		for (unsigned int row = 0; row < 3; ++row)
-		{
-			for (unsigned int col = 0; col < 3; ++col)
-			{
-				this->viewMatrix.at<float>(row, col) = (float)rot.at<double>(row, col);
-			}
-			this->viewMatrix.at<float>(row, 3) = (float)tvec[row];
-		}
-		this->viewMatrix.at<float>(3, 3) = 1.0f;
-
-		cv::Mat cvToGl = cv::Mat::zeros(4, 4, CV_32F);
-		cvToGl.at<float>(0, 0) = 1.0f;
-		cvToGl.at<float>(1, 1) = -1.0f; // Invert the y axis 
-		cvToGl.at<float>(2, 2) = -1.0f; // invert the z axis 
-		cvToGl.at<float>(3, 3) = 1.0f;
-		this->viewMatrix = cvToGl * this->viewMatrix;
-		cv::transpose(this->viewMatrix, this->viewMatrix);
-
-		this->is_mark = true;
+		// angle of R_pnp^T * R
+		double trace = 0;
+		for (int i = 0; i < 3; i++)
+			for (int k = 0; k < 3; k++)
+				trace += rot.at<double>(k, i) * this->planarPose.rotation(k, i);
+		double angle = std::acos(std::max(-1.0, std::min(1.0, (trace - 1) * 0.5))) * 180.0 / CV_PI;
+		this->maxRotationError = std::max(this->maxRotationError, angle);
+		this->maxTranslationError = std::max(this->maxTranslationError, cv::norm(tvec - this->planarPose.translation));
 	}
-	else
+
+	//ͬmaker-based ͬ, cv to gl: ȡ y, z ת
+	if (this->viewMatrix.rows != 4 || this->viewMatrix.cols != 4 || this->viewMatrix.type() != CV_32F)
+		this->viewMatrix = Mat::zeros(4, 4, CV_32F);
+	for (int row = 0; row < 3; ++row)
 	{
-		this->is_mark = false;
+		float sign = row == 0 ? 1.0f : -1.0f;
+		for (int col = 0; col < 3; ++col)
+			this->viewMatrix.at<float>(col, row) = sign * (float)this->planarPose.rotation(row, col);
+		this->viewMatrix.at<float>(3, row) = sign * (float)this->planarPose.translation[row];
+		this->viewMatrix.at<float>(row, 3) = 0.0f;
 	}
-
+	this->viewMatrix.at<float>(3, 3) = 1.0f;
+	return true;
 }
 
 CameraPose::CameraPose(bool use_markerless, String camera_params_file_path, String markerless_srcfile_path="src.jpg")
@@ -221,13 +439,88 @@ CameraPose::CameraPose(bool use_markerless, String camera_params_file_path, Stri
 	this->detectorParams = aruco::DetectorParameters::create();
 
 	if (this->using_markerless) {
-		this->img_object = imread(markerless_srcfile_path, IMREAD_GRAYSCALE);
-		this->detector = xfeatures2d::SURF::create(this->minHessian);
-		this->detector->detectAndCompute(this->img_object, noArray(), this->keypoints_object, this->descriptors_object);
+		this->features = makePtr<FeatureEngine>(FeatureEngine::parseFeatureType(this->featureName), FeatureEngine::parseMatcherType(this->matcherName));
+		this->features->setGrid(this->gridCols, this->gridRows, this->gridOverlap);
+		if (this->targetPaths.empty())
+			this->targetPaths.push_back(markerless_srcfile_path);
+
+		TickMeter startup;
+		startup.start();
+
+		//ʼĿͬʱѵʻ
+		std::vector<Mat> training;
+		uint64_t vocabulary_key = fnv1a(nullptr, 0);
+		for (size_t i = 0; i < this->targetPaths.size(); i++)
+		{
+			double width = 2 * i + 1 < this->targetSizes.size() ? this->targetSizes[2 * i] : 1.0;
+			double height = 2 * i + 1 < this->targetSizes.size() ? this->targetSizes[2 * i + 1] : 0;
+			if (this->addTarget(this->targetPaths[i], width, height) < 0)
+				continue;
+			training.push_back(this->targets.back().descriptors);
+			vocabulary_key = fnv1a(&this->targets.back().key, sizeof(uint64_t), vocabulary_key);
+		}
+
+		bool vocabulary_cached = this->useCache && this->vocabulary.load("markerless.vtree", vocabulary_key);
+		if (!vocabulary_cached)
+		{
+			this->vocabulary.build(training);
+			if (this->useCache)
+				this->vocabulary.save("markerless.vtree", vocabulary_key);
+		}
+		for (size_t i = 0; i < this->targets.size(); i++)
+			this->vocabulary.addTarget(this->targets[i].descriptors);
+
+		startup.stop();
+		std::cout << "[markerless] " << this->targets.size() << " targets ready in " << startup.getTimeMilli() << " ms ("
+			<< this->cacheHits << " from cache, vocabulary " << (vocabulary_cached ? "cached" : "built") << ")" << std::endl;
 	}
 
 }
 
+// Loads a reference image and indexes it; after construction this is cheap, the vocabulary tree is
+// not rebuilt. Returns the target id or -1 if the image has no usable features.
+// width, height: physical size in model units; height 0 keeps the image aspect
+int CameraPose::addTarget(const String &path, double width, double height)
+{
+	std::ifstream file(path, std::ios::binary);
+	std::vector<uchar> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	if (bytes.empty())
+	{
+		std::cout << "can not read " << path << std::endl;
+		return -1;
+	}
+
+	MarkerlessTarget target;
+	target.path = path;
+	String parameters = this->features->parameters();
+	target.key = fnv1a(parameters.data(), parameters.size(), fnv1a(bytes.data(), bytes.size()));
+
+	//ʧЧ(ͼ)ʱȡ
+	String cache_path = path + ".features";
+	if (this->useCache && FeatureCache::load(cache_path, target.key, target.size, target.keypoints, target.descriptors, target.mapping))
+		this->cacheHits++;
+	else
+	{
+		Mat image = imdecode(bytes, IMREAD_GRAYSCALE);
+		target.size = Size(image.cols, image.rows);
+		this->features->detect(image, target.keypoints, target.descriptors);
+		if (this->useCache && !target.descriptors.empty())
+			FeatureCache::save(cache_path, target.key, target.size, target.keypoints, target.descriptors);
+	}
+	if (target.descriptors.empty())
+	{
+		std::cout << "no features in " << path << std::endl;
+		return -1;
+	}
+	target.width = width;
+	target.height = height > 0 ? height : width * target.size.height / target.size.width;
+	target.matcher = this->features->createMatcher(target.descriptors);
+	this->targets.push_back(target);
+	if (!this->vocabulary.empty())
+		this->vocabulary.addTarget(target.descriptors);
+	return (int)this->targets.size() - 1;
+}
+
 CameraPose::~CameraPose()
 {
 }
\ No newline at end of file
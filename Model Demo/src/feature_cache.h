@@ -0,0 +1,208 @@
+#pragma once
+#include <opencv2\core.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace cv;
+
+// Read-only mapping of a whole file; the data stays valid as long as the object lives
+class MappedFile
+{
+public:
+	MappedFile(const String &path);
+	~MappedFile();
+
+	bool valid() const;
+	const uchar *data() const;
+	size_t size() const;
+
+private:
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+
+	const uchar *bytes = nullptr;
+	size_t length = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+#else
+	int fd = -1;
+#endif
+};
+
+MappedFile::MappedFile(const String &path)
+{
+#ifdef _WIN32
+	this->file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (this->file == INVALID_HANDLE_VALUE)
+		return;
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(this->file, &file_size) || file_size.QuadPart == 0)
+		return;
+	this->mapping = CreateFileMappingA(this->file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (this->mapping == NULL)
+		return;
+	this->bytes = (const uchar *)MapViewOfFile(this->mapping, FILE_MAP_READ, 0, 0, 0);
+	if (this->bytes)
+		this->length = (size_t)file_size.QuadPart;
+#else
+	this->fd = open(path.c_str(), O_RDONLY);
+	if (this->fd < 0)
+		return;
+	struct stat status;
+	if (fstat(this->fd, &status) != 0 || status.st_size == 0)
+		return;
+	void *address = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, this->fd, 0);
+	if (address == MAP_FAILED)
+		return;
+	this->bytes = (const uchar *)address;
+	this->length = (size_t)status.st_size;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+	if (this->bytes)
+		UnmapViewOfFile(this->bytes);
+	if (this->mapping != NULL)
+		CloseHandle(this->mapping);
+	if (this->file != INVALID_HANDLE_VALUE)
+		CloseHandle(this->file);
+#else
+	if (this->bytes)
+		munmap((void *)this->bytes, this->length);
+	if (this->fd >= 0)
+		close(this->fd);
+#endif
+}
+
+bool MappedFile::valid() const
+{
+	return this->bytes != nullptr;
+}
+
+const uchar *MappedFile::data() const
+{
+	return this->bytes;
+}
+
+size_t MappedFile::size() const
+{
+	return this->length;
+}
+
+// 64 bit FNV-1a, chainable through the seed
+inline uint64_t fnv1a(const void *data, size_t size, uint64_t hash = 14695981039346656037ULL)
+{
+	const uchar *bytes = (const uchar *)data;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// Keypoints and descriptors of one reference image on disk. The key hashes the image bytes and the
+// detector parameters; a file with another key or format version is stale and gets rewritten.
+// Descriptors are used in place from the mapping, so loading is a header check and a keypoint copy.
+class FeatureCache
+{
+public:
+	static const uint32_t kVersion = 1;
+
+	static bool load(const String &path, uint64_t key, Size &size, std::vector<KeyPoint> &keypoints, Mat &descriptors, Ptr<MappedFile> &mapping);
+	static bool save(const String &path, uint64_t key, Size size, const std::vector<KeyPoint> &keypoints, const Mat &descriptors);
+
+private:
+	struct Header
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t key;
+		int32_t width, height;
+		int32_t keypoints;
+		int32_t rows, cols, type;
+	};
+	struct KeyPointRecord
+	{
+		float x, y, size, angle, response;
+		int32_t octave, class_id;
+	};
+};
+
+bool FeatureCache::load(const String &path, uint64_t key, Size &size, std::vector<KeyPoint> &keypoints, Mat &descriptors, Ptr<MappedFile> &mapping)
+{
+	Ptr<MappedFile> file = makePtr<MappedFile>(path);
+	if (!file->valid() || file->size() < sizeof(Header))
+		return false;
+
+	Header header;
+	std::memcpy(&header, file->data(), sizeof(Header));
+	if (std::memcmp(header.magic, "FCAC", 4) != 0 || header.version != kVersion || header.key != key)
+		return false;
+
+	size_t descriptor_bytes = (size_t)header.rows * header.cols * CV_ELEM_SIZE(header.type);
+	size_t offset = sizeof(Header) + header.keypoints * sizeof(KeyPointRecord);
+	if (file->size() != offset + descriptor_bytes)
+		return false;
+
+	const KeyPointRecord *records = (const KeyPointRecord *)(file->data() + sizeof(Header));
+	keypoints.resize(header.keypoints);
+	for (int i = 0; i < header.keypoints; i++)
+	{
+		keypoints[i] = KeyPoint(Point2f(records[i].x, records[i].y), records[i].size, records[i].angle, records[i].response, records[i].octave, records[i].class_id);
+	}
+	descriptors = Mat(header.rows, header.cols, header.type, (void *)(file->data() + offset));
+	size = Size(header.width, header.height);
+	mapping = file;
+	return true;
+}
+
+bool FeatureCache::save(const String &path, uint64_t key, Size size, const std::vector<KeyPoint> &keypoints, const Mat &descriptors)
+{
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	if (!out)
+		return false;
+
+	Mat continuous = descriptors.isContinuous() ? descriptors : descriptors.clone();
+	Header header;
+	std::memcpy(header.magic, "FCAC", 4);
+	header.version = kVersion;
+	header.key = key;
+	header.width = size.width;
+	header.height = size.height;
+	header.keypoints = (int32_t)keypoints.size();
+	header.rows = continuous.rows;
+	header.cols = continuous.cols;
+	header.type = continuous.type();
+	out.write((const char *)&header, sizeof(Header));
+
+	for (size_t i = 0; i < keypoints.size(); i++)
+	{
+		const KeyPoint &kp = keypoints[i];
+		KeyPointRecord record = { kp.pt.x, kp.pt.y, kp.size, kp.angle, kp.response, kp.octave, kp.class_id };
+		out.write((const char *)&record, sizeof(KeyPointRecord));
+	}
+	out.write((const char *)continuous.data, continuous.total() * continuous.elemSize());
+	return (bool)out;
+}
@@ -0,0 +1,281 @@
+#pragma once
+#include <opencv2\core.hpp>
+#include <opencv2\features2d.hpp>
+#include <opencv2\flann.hpp>
+#include <opencv2\opencv_modules.hpp>
+#ifdef HAVE_OPENCV_XFEATURES2D
+#include <opencv2\xfeatures2d.hpp>
+#endif
+
+#include <iostream>
+#include <algorithm>
+#include <vector>
+
+using namespace cv;
+
+// Feature detector plus the matchers of the references: each target gets its own matcher, trained
+// once on its descriptors, so a frame only pays for detection and the index query. Binary features (ORB, AKAZE) are matched through a
+// multi-probe LSH index or brute force Hamming, SURF (opencv_contrib, non-free) through a kd-tree.
+// With a grid set, detection runs per cell on OpenCV's thread pool, each cell with its share of the
+// feature budget, which also spreads the keypoints evenly over the image.
+class FeatureEngine
+{
+public:
+	enum FeatureType { ORB_FEATURES, AKAZE_FEATURES, SURF_FEATURES };
+	enum MatcherType { LSH_MATCHER, BRUTE_FORCE_MATCHER, KDTREE_MATCHER };
+
+	FeatureEngine(FeatureType, MatcherType);
+
+	// a matcher trained on the reference descriptors, one per target
+	Ptr<DescriptorMatcher> createMatcher(const Mat &descriptors) const;
+	void detect(const Mat &image, std::vector<KeyPoint> &keypoints, Mat &descriptors);
+	// ratio test; queryIdx indexes the frame descriptors, trainIdx the reference ones
+	void match(const Ptr<DescriptorMatcher> &reference, const Mat &descriptors, std::vector<DMatch> &good_matches, float ratio_thresh = 0.75f);
+	// cols x rows cells; overlap pixels of context around each cell so the detector border is covered
+	void setGrid(int cols, int rows, int overlap = 32);
+	// extraction time, speedup and matches against reference for 1..max_threads threads
+	void benchmark(const Mat &image, const Ptr<DescriptorMatcher> &reference, int max_threads);
+	String name() const;
+	// everything that changes the detected features; part of the feature cache key
+	String parameters() const;
+
+	static FeatureType parseFeatureType(const String &name);
+	static MatcherType parseMatcherType(const String &name);
+
+private:
+	int minHessian = 400;
+	int maxFeatures = 1000;
+
+	FeatureType featureType;
+	MatcherType matcherType;
+	Ptr<Feature2D> detector;
+	std::vector< std::vector<DMatch> > knn_matches;
+
+	int gridCols = 1, gridRows = 1, gridOverlap = 32;
+	std::vector< Ptr<Feature2D> > cellDetectors;
+	std::vector< std::vector<KeyPoint> > cellKeypoints;
+	std::vector<Mat> cellDescriptors;
+
+	Ptr<Feature2D> createDetector(int max_features) const;
+	void detectTiled(const Mat &image, std::vector<KeyPoint> &keypoints, Mat &descriptors);
+};
+
+FeatureEngine::FeatureEngine(FeatureType feature_type, MatcherType matcher_type)
+{
+#ifndef HAVE_OPENCV_XFEATURES2D
+	if (feature_type == SURF_FEATURES)
+	{
+		std::cout << "SURF needs opencv_contrib, using ORB" << std::endl;
+		feature_type = ORB_FEATURES;
+	}
+#endif
+	bool binary = feature_type != SURF_FEATURES;
+	// kd-trees need float descriptors, LSH and Hamming need binary ones
+	if (binary && matcher_type == KDTREE_MATCHER)
+		matcher_type = LSH_MATCHER;
+	if (!binary && matcher_type == LSH_MATCHER)
+		matcher_type = KDTREE_MATCHER;
+
+	this->featureType = feature_type;
+	this->matcherType = matcher_type;
+
+	this->detector = this->createDetector(this->maxFeatures);
+}
+
+Ptr<Feature2D> FeatureEngine::createDetector(int max_features) const
+{
+	switch (this->featureType)
+	{
+	case ORB_FEATURES:
+		return ORB::create(max_features);
+	case AKAZE_FEATURES:
+		return AKAZE::create();
+	default:
+#ifdef HAVE_OPENCV_XFEATURES2D
+		return xfeatures2d::SURF::create(this->minHessian);
+#else
+		return Ptr<Feature2D>();
+#endif
+	}
+}
+
+void FeatureEngine::setGrid(int cols, int rows, int overlap)
+{
+	this->gridCols = std::max(1, cols);
+	this->gridRows = std::max(1, rows);
+	this->gridOverlap = std::max(0, overlap);
+
+	// one detector per cell, detectors are not shared between threads
+	int cells = this->gridCols * this->gridRows;
+	this->cellDetectors.resize(cells);
+	for (int i = 0; i < cells; i++)
+		this->cellDetectors[i] = this->createDetector(std::max(1, this->maxFeatures / cells));
+	this->cellKeypoints.resize(cells);
+	this->cellDescriptors.resize(cells);
+}
+
+// builds the index once; later frames are only queried against it
+Ptr<DescriptorMatcher> FeatureEngine::createMatcher(const Mat &descriptors) const
+{
+	Ptr<DescriptorMatcher> reference;
+	switch (this->matcherType)
+	{
+	case LSH_MATCHER:
+		// 6 tables, 12 bit keys, probe neighbouring buckets 1 bit away
+		reference = makePtr<FlannBasedMatcher>(makePtr<flann::LshIndexParams>(6, 12, 1));
+		break;
+	case BRUTE_FORCE_MATCHER:
+		reference = BFMatcher::create(this->featureType == SURF_FEATURES ? NORM_L2 : NORM_HAMMING);
+		break;
+	case KDTREE_MATCHER:
+		reference = makePtr<FlannBasedMatcher>();
+		break;
+	}
+	if (!descriptors.empty())
+	{
+		reference->add(std::vector<Mat>(1, descriptors));
+		reference->train();
+	}
+	return reference;
+}
+
+void FeatureEngine::detect(const Mat &image, std::vector<KeyPoint> &keypoints, Mat &descriptors)
+{
+	if (this->gridCols * this->gridRows > 1)
+		this->detectTiled(image, keypoints, descriptors);
+	else
+		this->detector->detectAndCompute(image, noArray(), keypoints, descriptors);
+}
+
+void FeatureEngine::detectTiled(const Mat &image, std::vector<KeyPoint> &keypoints, Mat &descriptors)
+{
+	int cells = this->gridCols * this->gridRows;
+	int budget = std::max(1, this->maxFeatures / cells);
+	float cell_width = image.cols / (float)this->gridCols;
+	float cell_height = image.rows / (float)this->gridRows;
+
+	parallel_for_(Range(0, cells), [&](const Range &range)
+	{
+		for (int i = range.start; i < range.end; i++)
+		{
+			int x0 = cvRound((i % this->gridCols) * cell_width), x1 = cvRound((i % this->gridCols + 1) * cell_width);
+			int y0 = cvRound((i / this->gridCols) * cell_height), y1 = cvRound((i / this->gridCols + 1) * cell_height);
+			int left = std::max(0, x0 - this->gridOverlap), top = std::max(0, y0 - this->gridOverlap);
+			int right = std::min(image.cols, x1 + this->gridOverlap), bottom = std::min(image.rows, y1 + this->gridOverlap);
+
+			std::vector<KeyPoint> &cell = this->cellKeypoints[i];
+			this->cellDetectors[i]->detect(image(Rect(left, top, right - left, bottom - top)), cell);
+
+			// the overlap is only context, a keypoint belongs to the cell it lies in
+			size_t kept = 0;
+			for (size_t k = 0; k < cell.size(); k++)
+			{
+				Point2f pt(cell[k].pt.x + left, cell[k].pt.y + top);
+				if (pt.x < x0 || pt.x >= x1 || pt.y < y0 || pt.y >= y1)
+					continue;
+				cell[kept] = cell[k];
+				cell[kept].pt = pt;
+				kept++;
+			}
+			cell.resize(kept);
+			KeyPointsFilter::retainBest(cell, budget);
+
+			// descriptors on the full image so patches near the cell border are complete
+			this->cellDetectors[i]->compute(image, cell, this->cellDescriptors[i]);
+		}
+	});
+
+	keypoints.clear();
+	descriptors.release();
+	for (int i = 0; i < cells; i++)
+	{
+		if (this->cellKeypoints[i].empty())
+			continue;
+		keypoints.insert(keypoints.end(), this->cellKeypoints[i].begin(), this->cellKeypoints[i].end());
+		descriptors.push_back(this->cellDescriptors[i]);
+	}
+}
+
+void FeatureEngine::benchmark(const Mat &image, const Ptr<DescriptorMatcher> &reference, int max_threads)
+{
+	int threads = getNumThreads();
+	std::vector<KeyPoint> keypoints;
+	Mat descriptors;
+	std::vector<DMatch> good_matches;
+	double single = 0;
+	for (int t = 1; t <= max_threads; t++)
+	{
+		setNumThreads(t);
+		TickMeter timer;
+		for (int run = 0; run < 5; run++)
+		{
+			timer.start();
+			this->detect(image, keypoints, descriptors);
+			timer.stop();
+		}
+		this->match(reference, descriptors, good_matches);
+
+		double ms = timer.getTimeMilli() / timer.getCounter();
+		if (t == 1)
+			single = ms;
+		std::cout << "[features] " << this->name() << " grid " << this->gridCols << "x" << this->gridRows << ", " << t << " threads: "
+			<< ms << " ms, speedup " << single / ms << ", " << keypoints.size() << " keypoints, " << good_matches.size() << " good matches" << std::endl;
+	}
+	setNumThreads(threads);
+}
+
+void FeatureEngine::match(const Ptr<DescriptorMatcher> &reference, const Mat &descriptors, std::vector<DMatch> &good_matches, float ratio_thresh)
+{
+	good_matches.clear();
+	if (descriptors.empty())
+		return;
+
+	reference->knnMatch(descriptors, this->knn_matches, 2);
+	for (size_t i = 0; i < this->knn_matches.size(); i++)
+	{
+		// LSH may come back with fewer than two neighbours
+		if (this->knn_matches[i].size() < 2)
+			continue;
+		if (this->knn_matches[i][0].distance < ratio_thresh * this->knn_matches[i][1].distance)
+			good_matches.push_back(this->knn_matches[i][0]);
+	}
+}
+
+String FeatureEngine::name() const
+{
+	const char *features[] = { "ORB", "AKAZE", "SURF" };
+	const char *matchers[] = { "LSH", "BF", "KDTREE" };
+	return String(features[this->featureType]) + "/" + matchers[this->matcherType];
+}
+
+String FeatureEngine::parameters() const
+{
+	String grid = " grid=" + std::to_string(this->gridCols) + "x" + std::to_string(this->gridRows) + "+" + std::to_string(this->gridOverlap);
+	switch (this->featureType)
+	{
+	case ORB_FEATURES:
+		return "ORB maxFeatures=" + std::to_string(this->maxFeatures) + grid;
+	case AKAZE_FEATURES:
+		return "AKAZE default" + grid;
+	default:
+		return "SURF minHessian=" + std::to_string(this->minHessian) + grid;
+	}
+}
+
+FeatureEngine::FeatureType FeatureEngine::parseFeatureType(const String &name)
+{
+	if (name == "AKAZE")
+		return AKAZE_FEATURES;
+	if (name == "SURF")
+		return SURF_FEATURES;
+	return ORB_FEATURES;
+}
+
+FeatureEngine::MatcherType FeatureEngine::parseMatcherType(const String &name)
+{
+	if (name == "BF")
+		return BRUTE_FORCE_MATCHER;
+	if (name == "KDTREE")
+		return KDTREE_MATCHER;
+	return LSH_MATCHER;
+}
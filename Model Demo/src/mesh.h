@@ -34,6 +34,13 @@ struct Texture {
     string path;
 };
 
+// one texture of a mesh, resolved against a shader: the unit it goes on and where that unit is set
+struct TextureBinding {
+    unsigned int unit;
+    unsigned int id;
+    int location;
+};
+
 class Mesh {
 public:
     /*  Mesh Data  */
@@ -55,32 +62,29 @@ public:
     }
 
     // render the mesh
-    void Draw(Shader shader) 
+    void Draw(const Shader &shader) 
     {
-        // bind appropriate textures
-        unsigned int diffuseNr  = 1;
-        unsigned int specularNr = 1;
-        unsigned int normalNr   = 1;
-        unsigned int heightNr   = 1;
-        for(unsigned int i = 0; i < textures.size(); i++)
+        // sampler names are looked up once per shader, after that a frame only sets units and binds
+        if(shader.ID != bindingProgram)
+            resolveBindings(shader);
+        for(unsigned int i = 0; i < bindings.size(); i++)
         {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
-            // retrieve texture number (the N in diffuse_textureN)
-            string number;
-            string name = textures[i].type;
-            if(name == "texture_diffuse")
-				number = std::to_string(diffuseNr++);
-			else if(name == "texture_specular")
-				number = std::to_string(specularNr++); // transfer unsigned int to stream
-            else if(name == "texture_normal")
-				number = std::to_string(normalNr++); // transfer unsigned int to stream
-             else if(name == "texture_height")
-			    number = std::to_string(heightNr++); // transfer unsigned int to stream
-
-													 // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
-            // and finally bind the texture
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+            if(bindings[i].location >= 0)
+                glUniform1i(bindings[i].location, bindings[i].unit);
+        }
+        bool bound = false;
+#if defined(GL_VERSION_4_4) || defined(GL_ARB_multi_bind)
+        // units 0..n-1 in one call
+        if(multiBind() && !bindingIds.empty())
+        {
+            glBindTextures(0, (GLsizei)bindingIds.size(), bindingIds.data());
+            bound = true;
+        }
+#endif
+        for(unsigned int i = 0; !bound && i < bindings.size(); i++)
+        {
+            glActiveTexture(GL_TEXTURE0 + bindings[i].unit);
+            glBindTexture(GL_TEXTURE_2D, bindings[i].id);
         }
         
         // draw mesh
@@ -95,8 +99,59 @@ public:
 private:
     /*  Render data  */
     unsigned int VBO, EBO;
+    vector<TextureBinding> bindings;
+    vector<GLuint> bindingIds;
+    unsigned int bindingProgram = 0;
 
     /*  Functions    */
+    // glBindTextures is there, from core 4.4 or the extension; each flag only exists if the loader
+    // was generated with it
+    static bool multiBind()
+    {
+        bool available = false;
+#if defined(GL_VERSION_4_4)
+        available = available || GLAD_GL_VERSION_4_4;
+#endif
+#if defined(GL_ARB_multi_bind)
+        available = available || GLAD_GL_ARB_multi_bind;
+#endif
+        return available;
+    }
+
+    // texture i goes on unit i, its sampler is named by type and its count within that type
+    // (texture_diffuse1, texture_diffuse2, texture_specular1, ...)
+    void resolveBindings(const Shader &shader)
+    {
+        unsigned int diffuseNr  = 1;
+        unsigned int specularNr = 1;
+        unsigned int normalNr   = 1;
+        unsigned int heightNr   = 1;
+        bindings.clear();
+        bindingIds.clear();
+        for(unsigned int i = 0; i < textures.size(); i++)
+        {
+            // retrieve texture number (the N in diffuse_textureN)
+            string number;
+            string name = textures[i].type;
+            if(name == "texture_diffuse")
+                number = std::to_string(diffuseNr++);
+            else if(name == "texture_specular")
+                number = std::to_string(specularNr++);
+            else if(name == "texture_normal")
+                number = std::to_string(normalNr++);
+            else if(name == "texture_height")
+                number = std::to_string(heightNr++);
+
+            TextureBinding binding;
+            binding.unit = i;
+            binding.id = textures[i].id;
+            binding.location = glGetUniformLocation(shader.ID, (name + number).c_str());
+            bindings.push_back(binding);
+            bindingIds.push_back(textures[i].id);
+        }
+        bindingProgram = shader.ID;
+    }
+
     // initializes all the buffer objects/arrays
     void setupMesh()
     {
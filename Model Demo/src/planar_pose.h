@@ -0,0 +1,118 @@
+#pragma once
+#include <opencv2\core.hpp>
+
+#include <cmath>
+
+using namespace cv;
+
+// Closed-form pose of a flat rectangular target from its four image corners. The corners are
+// undistorted, the rectangle-to-image homography is built directly (Heckbert's square-to-quad) and
+// split into rotation and translation, with the two rotation columns orthonormalized symmetrically.
+// Plain doubles only: no allocation and no iteration except the distortion inversion.
+class PlanarPose
+{
+public:
+	Matx33d rotation;
+	Vec3d translation;
+
+	// corners in pixels: top-left, top-right, bottom-right, bottom-left. The target lies in z = 0,
+	// centered on the origin, x to the right, y up, width x height in model units.
+	bool fromCorners(const Point2f corners[4], const Mat &camera_matrix, const Mat &dist_coeffs, double width, double height);
+
+	// the same on normalized (undistorted) image coordinates x0 y0 x1 y1 ...
+	bool fromNormalized(const double corners[8], double width, double height);
+};
+
+bool PlanarPose::fromCorners(const Point2f corners[4], const Mat &camera_matrix, const Mat &dist_coeffs, double width, double height)
+{
+	double fx = camera_matrix.at<double>(0, 0), fy = camera_matrix.at<double>(1, 1);
+	double cx = camera_matrix.at<double>(0, 2), cy = camera_matrix.at<double>(1, 2);
+
+	// k1 k2 p1 p2 k3; higher order terms are not used by our calibrations
+	double k[5] = { 0, 0, 0, 0, 0 };
+	int count = dist_coeffs.empty() ? 0 : (int)std::min<size_t>(5, dist_coeffs.total());
+	for (int i = 0; i < count; i++)
+		k[i] = dist_coeffs.at<double>(i);
+
+	double normalized[8];
+	for (int i = 0; i < 4; i++)
+	{
+		// fixed point iteration as in undistortPoints
+		double x0 = (corners[i].x - cx) / fx, y0 = (corners[i].y - cy) / fy;
+		double x = x0, y = y0;
+		for (int iteration = 0; iteration < 5; iteration++)
+		{
+			double r2 = x * x + y * y;
+			double icdist = 1.0 / (1.0 + ((k[4] * r2 + k[1]) * r2 + k[0]) * r2);
+			double dx = 2 * k[2] * x * y + k[3] * (r2 + 2 * x * x);
+			double dy = k[2] * (r2 + 2 * y * y) + 2 * k[3] * x * y;
+			x = (x0 - dx) * icdist;
+			y = (y0 - dy) * icdist;
+		}
+		normalized[2 * i] = x;
+		normalized[2 * i + 1] = y;
+	}
+	return this->fromNormalized(normalized, width, height);
+}
+
+bool PlanarPose::fromNormalized(const double corners[8], double width, double height)
+{
+	double x0 = corners[0], y0 = corners[1], x1 = corners[2], y1 = corners[3];
+	double x2 = corners[4], y2 = corners[5], x3 = corners[6], y3 = corners[7];
+
+	// unit square (s, t) = (0,0),(1,0),(1,1),(0,1) onto the four corners
+	double sx = x0 - x1 + x2 - x3, sy = y0 - y1 + y2 - y3;
+	double dx1 = x1 - x2, dx2 = x3 - x2, dy1 = y1 - y2, dy2 = y3 - y2;
+	double den = dx1 * dy2 - dx2 * dy1;
+	if (std::fabs(den) < 1e-12)
+		return false;
+	double g = (sx * dy2 - dx2 * sy) / den;
+	double h = (dx1 * sy - sx * dy1) / den;
+	double a = x1 - x0 + g * x1, b = x3 - x0 + h * x3;
+	double d = y1 - y0 + g * y1, e = y3 - y0 + h * y3;
+
+	// compose with the target plane -> unit square map s = X / width + 1/2, t = -Y / height + 1/2
+	double g1[3] = { a / width, d / width, g / width };
+	double g2[3] = { -b / height, -e / height, -h / height };
+	double g3[3] = { 0.5 * (a + b) + x0, 0.5 * (d + e) + y0, 0.5 * (g + h) + 1.0 };
+
+	double n1 = std::sqrt(g1[0] * g1[0] + g1[1] * g1[1] + g1[2] * g1[2]);
+	double n2 = std::sqrt(g2[0] * g2[0] + g2[1] * g2[1] + g2[2] * g2[2]);
+	if (n1 < 1e-12 || n2 < 1e-12)
+		return false;
+	// scale of the translation from the mean column norm, sign so that the target is in front of the camera
+	double lambda = 2.0 / (n1 + n2);
+	if (g3[2] < 0)
+		lambda = -lambda;
+
+	// closest orthonormal pair to (r1, r2): with both columns at unit length their sum and difference
+	// are orthogonal, normalized and rotated back by 45 degrees they split the angle error evenly
+	double sign = lambda < 0 ? -1.0 : 1.0;
+	double c[3], m[3];
+	for (int i = 0; i < 3; i++)
+	{
+		c[i] = (g1[i] / n1 + g2[i] / n2) * sign;
+		m[i] = (g1[i] / n1 - g2[i] / n2) * sign;
+	}
+	double lc = std::sqrt(c[0] * c[0] + c[1] * c[1] + c[2] * c[2]);
+	double lm = std::sqrt(m[0] * m[0] + m[1] * m[1] + m[2] * m[2]);
+	if (lc < 1e-12 || lm < 1e-12)
+		return false;
+	double nc = 1.0 / lc, nm = 1.0 / lm;
+	double r1[3], r2[3];
+	for (int i = 0; i < 3; i++)
+	{
+		r1[i] = (c[i] * nc + m[i] * nm) * 0.70710678118654752;
+		r2[i] = (c[i] * nc - m[i] * nm) * 0.70710678118654752;
+	}
+	double r3[3] = { r1[1] * r2[2] - r1[2] * r2[1], r1[2] * r2[0] - r1[0] * r2[2], r1[0] * r2[1] - r1[1] * r2[0] };
+
+	for (int i = 0; i < 3; i++)
+	{
+		this->rotation(i, 0) = r1[i];
+		this->rotation(i, 1) = r2[i];
+		this->rotation(i, 2) = r3[i];
+		this->translation[i] = g3[i] * lambda;
+	}
+	return true;
+}
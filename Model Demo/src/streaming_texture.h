@@ -0,0 +1,113 @@
+#pragma once
+#include <glad/glad.h>
+
+#include <opencv2\core.hpp>
+
+// Texture refilled with the camera frame every frame. Storage is allocated once (glTexStorage2D
+// where the context has it) and again only if the frame size or type changes; a frame is a
+// glTexSubImage2D into level 0, no mipmaps.
+class StreamingTexture
+{
+public:
+	StreamingTexture();
+	~StreamingTexture();
+
+	// CV_8UC1, CV_8UC3 (BGR) or CV_8UC4 (BGRA); leaves the texture bound on the active unit
+	void update(const cv::Mat &image);
+	void bind() const;
+	int allocations() const;
+
+private:
+	StreamingTexture(const StreamingTexture &) = delete;
+	StreamingTexture &operator=(const StreamingTexture &) = delete;
+
+	unsigned int texture = 0;
+	int width = 0, height = 0, type = -1;
+	int allocationCount = 0;
+
+	static bool formats(int type, GLenum &internal_format, GLenum &format);
+	void allocate(int width, int height, int type);
+};
+
+StreamingTexture::StreamingTexture()
+{
+}
+
+StreamingTexture::~StreamingTexture()
+{
+	if (this->texture)
+		glDeleteTextures(1, &this->texture);
+}
+
+bool StreamingTexture::formats(int type, GLenum &internal_format, GLenum &format)
+{
+	switch (type)
+	{
+	case CV_8UC1: internal_format = GL_R8; format = GL_RED; return true;
+	case CV_8UC3: internal_format = GL_RGB8; format = GL_BGR; return true;
+	case CV_8UC4: internal_format = GL_RGBA8; format = GL_BGRA; return true;
+	default: return false;
+	}
+}
+
+//ɱ洢ܸĳߴ, ߴ˾ͻһ
+void StreamingTexture::allocate(int width, int height, int type)
+{
+	GLenum internal_format, format;
+	formats(type, internal_format, format);
+
+	if (this->texture)
+		glDeleteTextures(1, &this->texture);
+	glGenTextures(1, &this->texture);
+	glBindTexture(GL_TEXTURE_2D, this->texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+
+	bool immutable = false;
+#if defined(GL_VERSION_4_2)
+	if (GLAD_GL_VERSION_4_2)
+	{
+		glTexStorage2D(GL_TEXTURE_2D, 1, internal_format, width, height);
+		immutable = true;
+	}
+#endif
+	if (!immutable)
+		glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, GL_UNSIGNED_BYTE, NULL);
+
+	this->width = width;
+	this->height = height;
+	this->type = type;
+	this->allocationCount++;
+}
+
+void StreamingTexture::update(const cv::Mat &image)
+{
+	GLenum internal_format, format;
+	if (image.empty() || !formats(image.type(), internal_format, format))
+		return;
+
+	if (!this->texture || image.cols != this->width || image.rows != this->height || image.type() != this->type)
+		this->allocate(image.cols, image.rows, image.type());
+	else
+		glBindTexture(GL_TEXTURE_2D, this->texture);
+
+	//Matвһ4ֽڶ, Ҳһ
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, (GLint)(image.step[0] / image.elemSize()));
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image.cols, image.rows, format, GL_UNSIGNED_BYTE, image.data);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+void StreamingTexture::bind() const
+{
+	glBindTexture(GL_TEXTURE_2D, this->texture);
+}
+
+int StreamingTexture::allocations() const
+{
+	return this->allocationCount;
+}
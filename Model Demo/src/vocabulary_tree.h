@@ -0,0 +1,460 @@
+#pragma once
+#include <opencv2\core.hpp>
+#include <opencv2\core\hal\hal.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+#include "feature_cache.h"
+
+using namespace cv;
+
+// Bag-of-words recognition index (Nister & Stewenius, "Scalable Recognition with a Vocabulary Tree").
+// The tree is clustered once from training descriptors: k-majority for binary descriptors (ORB,
+// AKAZE), k-means for float ones (SURF). Targets are quantized into its leaves and stored in an
+// inverted file, so adding a target never touches the tree and a query only visits the targets
+// that share words with the frame.
+class VocabularyTree
+{
+public:
+	VocabularyTree(int branching = 10, int depth = 4);
+
+	// one Mat of descriptors per training image; the idf weights come from the same images
+	void build(const std::vector<Mat> &training);
+	int addTarget(const Mat &descriptors);
+	// target ids sorted by histogram intersection with the frame, best first
+	void query(const Mat &descriptors, std::vector<int> &candidates, int max_candidates);
+
+	// the clustered tree and idf weights, without targets; key identifies the training set
+	bool load(const String &path, uint64_t key);
+	bool save(const String &path, uint64_t key) const;
+
+	bool empty() const;
+	int words() const;
+	int targets() const;
+
+	// query latency on random descriptors of the given type (CV_8U binary, CV_32F float) at 1, 10, ...
+	// up to max_targets targets of 300 descriptors each, against a tree built from random ones too
+	static void benchmark(int type, int cols, int max_targets = 10000);
+
+private:
+	struct Node
+	{
+		int firstChild;
+		int childCount;
+		int word;
+	};
+	struct Entry
+	{
+		int target;
+		float weight;
+	};
+	struct Header
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t key;
+		int32_t branching, depth;
+		int32_t nodes, words;
+		int32_t cols, type;
+	};
+	static const uint32_t kVersion = 1;
+
+	int branching;
+	int depth;
+	int kmeansIterations = 8;
+
+	std::vector<Node> nodes;
+	Mat centers;//ÿڵһ
+	std::vector<float> idf;
+	std::vector< std::vector<Entry> > invertedFile;
+	int targetCount = 0;
+
+	std::vector<float> scores;
+	std::vector<int> touched;
+	std::vector< std::pair<int, float> > bow;
+	std::vector<int> wordCounts;
+
+	float distance(const uchar *a, const uchar *b) const;
+	int quantize(const uchar *descriptor) const;
+	void transform(const Mat &descriptors, std::vector< std::pair<int, float> > &histogram);
+	void split(int node, const Mat &data, const std::vector<int> &indices, int level);
+	void cluster(const Mat &data, const std::vector<int> &indices, Mat &cluster_centers, std::vector<int> &labels) const;
+};
+
+VocabularyTree::VocabularyTree(int branching, int depth)
+{
+	this->branching = branching;
+	this->depth = depth;
+}
+
+float VocabularyTree::distance(const uchar *a, const uchar *b) const
+{
+	if (this->centers.depth() == CV_8U)
+		return (float)hal::normHamming(a, b, this->centers.cols);
+
+	const float *fa = (const float *)a, *fb = (const float *)b;
+	float sum = 0;
+	for (int i = 0; i < this->centers.cols; i++)
+		sum += (fa[i] - fb[i]) * (fa[i] - fb[i]);
+	return sum;
+}
+
+int VocabularyTree::quantize(const uchar *descriptor) const
+{
+	int node = 0;
+	while (this->nodes[node].childCount > 0)
+	{
+		const Node &parent = this->nodes[node];
+		int best = parent.firstChild;
+		float best_distance = this->distance(descriptor, this->centers.ptr(best));
+		for (int c = parent.firstChild + 1; c < parent.firstChild + parent.childCount; c++)
+		{
+			float d = this->distance(descriptor, this->centers.ptr(c));
+			if (d < best_distance)
+			{
+				best_distance = d;
+				best = c;
+			}
+		}
+		node = best;
+	}
+	return this->nodes[node].word;
+}
+
+void VocabularyTree::cluster(const Mat &data, const std::vector<int> &indices, Mat &cluster_centers, std::vector<int> &labels) const
+{
+	int k = this->branching;
+	int n = (int)indices.size();
+	bool binary = data.depth() == CV_8U;
+
+	// evenly spread seeds are good enough here and keep the build deterministic
+	cluster_centers.create(k, data.cols, data.type());
+	for (int c = 0; c < k; c++)
+		data.row(indices[(size_t)c * n / k]).copyTo(cluster_centers.row(c));
+
+	labels.assign(n, 0);
+	int bits = data.cols * 8;
+	std::vector<double> sums(binary ? bits : data.cols);
+	for (int iteration = 0; iteration < this->kmeansIterations; iteration++)
+	{
+		for (int i = 0; i < n; i++)
+		{
+			const uchar *descriptor = data.ptr(indices[i]);
+			float best_distance = this->distance(descriptor, cluster_centers.ptr(0));
+			labels[i] = 0;
+			for (int c = 1; c < k; c++)
+			{
+				float d = this->distance(descriptor, cluster_centers.ptr(c));
+				if (d < best_distance)
+				{
+					best_distance = d;
+					labels[i] = c;
+				}
+			}
+		}
+
+		for (int c = 0; c < k; c++)
+		{
+			std::fill(sums.begin(), sums.end(), 0.0);
+			int members = 0;
+			for (int i = 0; i < n; i++)
+			{
+				if (labels[i] != c)
+					continue;
+				members++;
+				const uchar *descriptor = data.ptr(indices[i]);
+				if (binary)
+				{
+					for (int b = 0; b < bits; b++)
+						sums[b] += (descriptor[b >> 3] >> (7 - (b & 7))) & 1;
+				}
+				else
+				{
+					const float *values = (const float *)descriptor;
+					for (int j = 0; j < data.cols; j++)
+						sums[j] += values[j];
+				}
+			}
+			//մرԭ
+			if (members == 0)
+				continue;
+
+			uchar *center = cluster_centers.ptr(c);
+			if (binary)
+			{
+				std::fill(center, center + data.cols, (uchar)0);
+				for (int b = 0; b < bits; b++)
+					if (sums[b] * 2 > members)
+						center[b >> 3] |= (uchar)(1 << (7 - (b & 7)));
+			}
+			else
+			{
+				float *values = (float *)center;
+				for (int j = 0; j < data.cols; j++)
+					values[j] = (float)(sums[j] / members);
+			}
+		}
+	}
+}
+
+void VocabularyTree::split(int node, const Mat &data, const std::vector<int> &indices, int level)
+{
+	if (level == this->depth || (int)indices.size() <= this->branching)
+	{
+		this->nodes[node].word = (int)this->idf.size();
+		this->idf.push_back(0);
+		return;
+	}
+
+	Mat cluster_centers;
+	std::vector<int> labels;
+	this->cluster(data, indices, cluster_centers, labels);
+
+	int first = (int)this->nodes.size();
+	this->nodes[node].firstChild = first;
+	this->nodes[node].childCount = this->branching;
+	for (int c = 0; c < this->branching; c++)
+	{
+		this->nodes.push_back(Node{ 0, 0, -1 });
+		this->centers.push_back(cluster_centers.row(c));
+	}
+
+	std::vector<int> subset;
+	for (int c = 0; c < this->branching; c++)
+	{
+		subset.clear();
+		for (size_t i = 0; i < indices.size(); i++)
+			if (labels[i] == c)
+				subset.push_back(indices[i]);
+		this->split(first + c, data, subset, level + 1);
+	}
+}
+
+void VocabularyTree::build(const std::vector<Mat> &training)
+{
+	Mat data;
+	for (size_t i = 0; i < training.size(); i++)
+		data.push_back(training[i]);
+	if (data.empty())
+		return;
+
+	this->nodes.assign(1, Node{ 0, 0, -1 });
+	this->centers = Mat();
+	this->centers.push_back(data.row(0));//ڵĲȽ
+	this->idf.clear();
+	std::vector<int> indices(data.rows);
+	for (int i = 0; i < data.rows; i++)
+		indices[i] = i;
+	this->split(0, data, indices, 0);
+
+	// idf = log(1 + N / n_w), n_w = training images containing word w
+	std::vector<int> images(this->idf.size(), 0);
+	std::vector<int> last_image(this->idf.size(), -1);
+	for (size_t i = 0; i < training.size(); i++)
+	{
+		for (int r = 0; r < training[i].rows; r++)
+		{
+			int word = this->quantize(training[i].ptr(r));
+			if (last_image[word] == (int)i)
+				continue;
+			last_image[word] = (int)i;
+			images[word]++;
+		}
+	}
+	for (size_t w = 0; w < this->idf.size(); w++)
+		this->idf[w] = (float)std::log(1.0 + (double)training.size() / std::max(1, images[w]));
+
+	this->invertedFile.assign(this->idf.size(), std::vector<Entry>());
+	this->targetCount = 0;
+	this->scores.clear();
+}
+
+// L1 normalized tf-idf histogram, sparse and sorted by word
+void VocabularyTree::transform(const Mat &descriptors, std::vector< std::pair<int, float> > &histogram)
+{
+	histogram.clear();
+	this->wordCounts.clear();
+	for (int r = 0; r < descriptors.rows; r++)
+		this->wordCounts.push_back(this->quantize(descriptors.ptr(r)));
+	std::sort(this->wordCounts.begin(), this->wordCounts.end());
+
+	float total = 0;
+	for (size_t i = 0; i < this->wordCounts.size();)
+	{
+		size_t j = i;
+		while (j < this->wordCounts.size() && this->wordCounts[j] == this->wordCounts[i])
+			j++;
+		float weight = (float)(j - i) * this->idf[this->wordCounts[i]];
+		histogram.push_back(std::make_pair(this->wordCounts[i], weight));
+		total += weight;
+		i = j;
+	}
+	if (total > 0)
+		for (size_t i = 0; i < histogram.size(); i++)
+			histogram[i].second /= total;
+}
+
+int VocabularyTree::addTarget(const Mat &descriptors)
+{
+	int target = this->targetCount++;
+	this->transform(descriptors, this->bow);
+	for (size_t i = 0; i < this->bow.size(); i++)
+		this->invertedFile[this->bow[i].first].push_back(Entry{ target, this->bow[i].second });
+	this->scores.push_back(0);
+	return target;
+}
+
+void VocabularyTree::query(const Mat &descriptors, std::vector<int> &candidates, int max_candidates)
+{
+	candidates.clear();
+	if (this->empty() || descriptors.empty())
+		return;
+
+	// histogram intersection sum(min(q, d)) equals 1 - |q - d| / 2 for L1 normalized vectors
+	this->transform(descriptors, this->bow);
+	this->touched.clear();
+	for (size_t i = 0; i < this->bow.size(); i++)
+	{
+		const std::vector<Entry> &entries = this->invertedFile[this->bow[i].first];
+		float q = this->bow[i].second;
+		for (size_t e = 0; e < entries.size(); e++)
+		{
+			float &score = this->scores[entries[e].target];
+			if (score == 0)
+				this->touched.push_back(entries[e].target);
+			score += std::max(std::min(q, entries[e].weight), 1e-12f);
+		}
+	}
+
+	int count = std::min(max_candidates, (int)this->touched.size());
+	std::partial_sort(this->touched.begin(), this->touched.begin() + count, this->touched.end(),
+		[this](int a, int b) { return this->scores[a] > this->scores[b]; });
+	candidates.assign(this->touched.begin(), this->touched.begin() + count);
+	for (size_t i = 0; i < this->touched.size(); i++)
+		this->scores[this->touched[i]] = 0;
+}
+
+bool VocabularyTree::load(const String &path, uint64_t key)
+{
+	MappedFile file(path);
+	if (!file.valid() || file.size() < sizeof(Header))
+		return false;
+
+	Header header;
+	std::memcpy(&header, file.data(), sizeof(Header));
+	if (std::memcmp(header.magic, "VTRE", 4) != 0 || header.version != kVersion || header.key != key ||
+		header.branching != this->branching || header.depth != this->depth)
+		return false;
+
+	size_t center_bytes = (size_t)header.cols * CV_ELEM_SIZE(header.type);
+	size_t nodes_offset = sizeof(Header);
+	size_t centers_offset = nodes_offset + header.nodes * sizeof(Node);
+	size_t idf_offset = centers_offset + header.nodes * center_bytes;
+	if (file.size() != idf_offset + header.words * sizeof(float))
+		return false;
+
+	this->nodes.resize(header.nodes);
+	std::memcpy(this->nodes.data(), file.data() + nodes_offset, header.nodes * sizeof(Node));
+	this->centers = Mat(header.nodes, header.cols, header.type, (void *)(file.data() + centers_offset)).clone();
+	this->idf.resize(header.words);
+	std::memcpy(this->idf.data(), file.data() + idf_offset, header.words * sizeof(float));
+
+	this->invertedFile.assign(this->idf.size(), std::vector<Entry>());
+	this->targetCount = 0;
+	this->scores.clear();
+	return true;
+}
+
+bool VocabularyTree::save(const String &path, uint64_t key) const
+{
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	if (!out || this->empty())
+		return false;
+
+	Header header;
+	std::memcpy(header.magic, "VTRE", 4);
+	header.version = kVersion;
+	header.key = key;
+	header.branching = this->branching;
+	header.depth = this->depth;
+	header.nodes = (int32_t)this->nodes.size();
+	header.words = (int32_t)this->idf.size();
+	header.cols = this->centers.cols;
+	header.type = this->centers.type();
+	out.write((const char *)&header, sizeof(Header));
+	out.write((const char *)this->nodes.data(), this->nodes.size() * sizeof(Node));
+	for (int r = 0; r < this->centers.rows; r++)
+		out.write((const char *)this->centers.ptr(r), this->centers.cols * this->centers.elemSize());
+	out.write((const char *)this->idf.data(), this->idf.size() * sizeof(float));
+	return (bool)out;
+}
+
+bool VocabularyTree::empty() const
+{
+	return this->idf.empty();
+}
+
+int VocabularyTree::words() const
+{
+	return (int)this->idf.size();
+}
+
+int VocabularyTree::targets() const
+{
+	return this->targetCount;
+}
+
+void VocabularyTree::benchmark(int type, int cols, int max_targets)
+{
+	const int training_images = 40, descriptors_per_image = 500, descriptors_per_target = 300;
+	RNG rng(0x5eed);
+	auto random_descriptors = [&](int rows)
+	{
+		Mat descriptors(rows, cols, type);
+		if (type == CV_8U)
+			rng.fill(descriptors, RNG::UNIFORM, 0, 256);
+		else
+			rng.fill(descriptors, RNG::UNIFORM, 0.0f, 1.0f);
+		return descriptors;
+	};
+
+	std::vector<Mat> training;
+	for (int i = 0; i < training_images; i++)
+		training.push_back(random_descriptors(descriptors_per_image));
+	VocabularyTree tree;
+	TickMeter build_timer;
+	build_timer.start();
+	tree.build(training);
+	build_timer.stop();
+	std::cout << "[vocabulary] " << (type == CV_8U ? "binary " : "float ") << cols << " cols, " << tree.words() << " words, built in "
+		<< build_timer.getTimeMilli() << " ms" << std::endl;
+
+	//֡һǵһĿ, һ
+	Mat first = random_descriptors(descriptors_per_target);
+	Mat frame = first.rowRange(0, descriptors_per_target / 2).clone();
+	frame.push_back(random_descriptors(descriptors_per_target / 2));
+
+	std::vector<int> candidates;
+	TickMeter add_timer;
+	for (int checkpoint = 1; checkpoint <= max_targets; checkpoint *= 10)
+	{
+		add_timer.start();
+		while (tree.targets() < checkpoint)
+			tree.addTarget(tree.targets() == 0 ? first : random_descriptors(descriptors_per_target));
+		add_timer.stop();
+
+		TickMeter query_timer;
+		for (int run = 0; run < 20; run++)
+		{
+			query_timer.start();
+			tree.query(frame, candidates, 5);
+			query_timer.stop();
+		}
+		std::cout << "[vocabulary] " << checkpoint << " targets: query " << query_timer.getTimeMilli() / query_timer.getCounter()
+			<< " ms, best " << (candidates.empty() ? -1 : candidates[0]) << ", adding " << add_timer.getTimeMilli() / tree.targets()
+			<< " ms per target" << std::endl;
+	}
+}
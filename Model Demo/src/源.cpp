@@ -14,9 +14,28 @@
 #include "backmesh.h"
 
 #include <iostream>
+#include <atomic>
+#include <cstdlib>
+#include <new>
 
 using namespace cv;
 
+//ͳƶѷ, ȷģͻʱٹַ
+static std::atomic<size_t> allocationCount(0);
+
+void *operator new(size_t size)
+{
+	allocationCount++;
+	if (void *p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void processInput(GLFWwindow *window);
 
@@ -137,6 +156,8 @@ int main()
 	buildProjectionMatrix(0.01f, 1000.0f);
 
 	Mat frame;
+	size_t drawAllocations = 0;
+	unsigned int drawnFrames = 0;
 
 	while (!glfwWindowShouldClose(window))
 	{
@@ -161,12 +182,19 @@ int main()
 
 		if (ourCameraPose.is_mark)
 		{
+			size_t before = allocationCount;
 			ourModel.Draw(ourShader);
+			//һ֡Ҫʰ, 
+			if (drawnFrames++ > 0)
+				drawAllocations += allocationCount - before;
 		}
 		glfwSwapBuffers(window);
 		glfwPollEvents();
 	}
 
+	if (drawnFrames > 1)
+		std::cout << "model draw: " << drawAllocations << " allocations in " << drawnFrames - 1 << " frames" << std::endl;
+
 	glfwTerminate();
 	return 0;
 }
@@ -7,19 +7,49 @@
 #include <vector>
 
 #include "shader.h"
+#include "streaming_texture.h"
 
 using namespace std;
 using namespace cv;
 
+// Full-screen camera image. BGR frames are uploaded as they are; raw NV12 / YUYV frames are uploaded
+// as luma and chroma (2 or 1.5 bytes per pixel instead of 3) and converted in the fragment shader.
 class Background
 {
+public:
+	enum Format { BGR = 0, NV12 = 1, YUYV = 2 };
+
 private:
-	unsigned int VAO, VBO, EBO;
+	unsigned int VAO;
+	unsigned int map_texture_;//undistortion lookup, 0 if disabled
+	StreamingTexture texture_;//camera frame or luma (NV12) or packed YUYV, allocated once
+	StreamingTexture chroma_;//interleaved UV at half resolution, NV12 only
+	Format format_;
+	Size frame_size_;
 	shared_ptr<Shader> shader_ptr_;
+	int32_t undistort_uniform_, format_uniform_, chroma_uniform_, undistort_map_uniform_;
+
+	static bool IsRaw(const Mat &raw, Format format, Size size);
 
 public:
-	Background();
+	Background(StreamingTexture::Upload upload = StreamingTexture::DIRECT, int buffers = 3);
 	~Background();
 
-	void Draw(Mat &frame);
+	void SetUndistortMap(const Mat &map);
+	// frames of this format and size from now on, in capture row order (not flipped)
+	void SetFormat(Format format, Size size);
+	// views the planes of a raw frame without copying (luma of YUYV is extracted); false if the
+	// buffer does not hold a frame of this format and size
+	static bool Planes(const Mat &raw, Format format, Size size, Mat &luma, Mat &chroma);
+	static Format ParseFormat(const string &name);
+	// fills texture (and chroma for NV12) from a frame; for callers that keep their own textures
+	static void Upload(const Mat &frame, Format format, Size size, StreamingTexture &texture, StreamingTexture &chroma);
+	// upload a new camera frame; Draw keeps showing the last one until the next call
+	void Update(const Mat &frame);
+	void Draw();
+	// draws textures filled elsewhere (by Upload, possibly on another context)
+	void Draw(unsigned int texture, unsigned int chroma);
+	const StreamingTexture &texture() const;
+	// CPU time per frame of the old flip + mipmap path against the current one
+	static void Benchmark(Size size, int frames);
 };
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+#include "background.h"
+#include "streaming_texture.h"
+
+// Uploads camera frames on its own thread, through a hidden window whose context shares objects with
+// the render window. Frames go into a small pool of textures; a finished one is published with a
+// fence. The render thread only makes the GPU wait on that fence (glWaitSync) and binds the
+// textures, so no upload work is left on it. A texture the render thread lets go of gets a fence
+// from the render context that the uploader waits for before writing into it again.
+class BackgroundUploader {
+public:
+	BackgroundUploader(GLFWwindow *window, Background::Format format, cv::Size size,
+		StreamingTexture::Upload upload = StreamingTexture::DIRECT, int buffers = 3, int pool = 3);
+	~BackgroundUploader();
+	BackgroundUploader(const BackgroundUploader &) = delete;
+	BackgroundUploader &operator=(const BackgroundUploader &) = delete;
+
+	bool valid() const;
+	// capture side: takes the frame by swapping, frame gets an older buffer back
+	void Submit(cv::Mat &frame);
+	// render thread: switches to the newest uploaded frame if there is one. Returns false until
+	// the first frame is ready; upload_ms is set to that frame's upload time, or -1 if nothing new.
+	bool Acquire(unsigned int &texture, unsigned int &chroma, double &upload_ms);
+	// frames replaced by a newer one before they were uploaded or shown
+	int dropped() const;
+
+private:
+	enum State { FREE, UPLOADING, READY, SHOWN };
+	struct Slot {
+		std::unique_ptr<StreamingTexture> texture, chroma;
+		GLsync ready_fence, release_fence;
+		State state;
+		double upload_ms;
+	};
+
+	void Run();
+	int TakeSlot();
+
+	GLFWwindow *context_;
+	Background::Format format_;
+	cv::Size size_;
+	StreamingTexture::Upload upload_;
+	int buffers_;
+
+	mutable std::mutex mutex_;
+	std::condition_variable pending_cv_;
+	cv::Mat pending_;
+	bool has_pending_, running_;
+	std::vector<Slot> slots_;
+	int ready_, shown_, dropped_;
+	std::thread thread_;
+};
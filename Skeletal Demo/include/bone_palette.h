@@ -0,0 +1,56 @@
+#pragma once
+
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+// Skinning matrices of every instance drawn in a frame, in one texture buffer (RGBA32F). A bone is
+// the affine 3x4 part of its matrix, three texels holding its rows: 48 bytes instead of the 64 of a
+// mat4 uniform, and no MAX_BONES. The shader reads bone i of an instance at texels base + 3 * i,
+// base + 3 * i + 1, ...
+//
+// The buffer is a ring of segments, one per frame in flight. Begin maps the next segment
+// unsynchronized once its fence has signalled, Add copies a palette in and returns its base, End
+// unmaps. The fence of a segment is set at the following Begin, after the draws that read it. A
+// frame that asked for more bones than fit makes the next Begin reallocate the ring large enough. The
+// texture spans the whole ring, so all segments together must fit GL_MAX_TEXTURE_BUFFER_SIZE texels:
+// GL_MAX_TEXTURE_BUFFER_SIZE / (3 * segments) bones per frame, at least 7281 with three segments.
+class BonePalette {
+public:
+	// initial capacity in bones per frame, over all instances; clamped to what the texture can address
+	BonePalette(int capacity, int segments = 3);
+	~BonePalette();
+	BonePalette(const BonePalette &) = delete;
+	BonePalette &operator=(const BonePalette &) = delete;
+
+	void Begin();
+	// first texel of the palette for the shader, -1 if it does not fit into this frame any more
+	int Add(const std::vector<glm::mat4> &matrices);
+	int Add(const glm::mat4 *matrices, int count);
+	void End();
+	// the texture buffer on the given unit, for a samplerBuffer
+	void Bind(int unit) const;
+
+	// bones per frame, after clamping and growing
+	int capacity() const;
+	// bytes written since Begin
+	size_t uploaded_bytes() const;
+	// segments the GPU was still reading when their turn came again
+	int busy_segments() const;
+
+private:
+	static const int kTexelsPerBone = 3;
+
+	// (re)creates the storage of every segment for the given bones per frame, dropping the fences
+	void Allocate(int capacity);
+
+	unsigned int buffer_, texture_;
+	int capacity_, max_capacity_;
+	// bones asked for since Begin, fitting or not
+	int requested_;
+	size_t segment_size_;
+	std::vector<GLsync> fences_;
+	int segment_, used_, busy_segments_;
+	glm::vec4 *mapped_;
+};
@@ -5,13 +5,29 @@
 
 #include <glm\glm.hpp>
 
+#include <map>
+#include <atomic>
+
 #include "config.h"
+#include "square_pose.h"
+#include "pose_filter.h"
+#include "pose_mailbox.h"
 
 using namespace std;
 using namespace glm;
 using namespace cv;
 using namespace cv::aruco;
 
+// Calibration rescaled to one working resolution
+struct Intrinsics
+{
+	Size size;
+	Mat camera_matrix;
+	Mat dist_coeffs;
+	Mat projection_matrix;
+	Mat undistort_map;//ȥұ
+};
+
 class Camera
 {
 private:
@@ -21,21 +37,47 @@ private:
 	Mat camera_matrix_;//ڲ
 	Mat dist_coeffs_;//ϵ
 
-	Mat view_matrix_;
-	Mat projection_matrix_;
+	map<pair<int, int>, Intrinsics> intrinsics_;//ÿֱһ, ֻɾ
+	atomic<Intrinsics *> active_;//ֱ
+	atomic<Intrinsics *> display_;//ʾֱ
+	vector< vector<cv::Point2f> > display_corners_;
 
 	Ptr<Dictionary> dictionary_;//ֵ
 
-	void setProjection();
+	SquarePoseSolver pose_solver_;//IPPE λ
+	vector<SquarePose> poses_;
+
+	PoseFilter::Mode filter_mode_;
+	map<int, PoseFilter> pose_filters_;//ÿһ˲
+	int anchor_id_;
+
+	PoseMailbox<PoseState> pose_mailbox_;//߳д, Ⱦ̶߳
+	PoseState latched_pose_;
+	mat4 last_view_matrix_;
+	double display_time_;
+
+	void setProjection(Intrinsics &intrinsics);
+	void setUndistortMap(Intrinsics &intrinsics);
+	Intrinsics &get_intrinsics(Size size);
 public:
 	Camera(shared_ptr<Config> config_ptr);
 	~Camera();
 
-	bool marker_based_compute(Mat &frame);
+	void prepare_working_sizes(const vector<Size> &sizes);
+	void set_working_size(Size size);
+	void set_display_size(Size size);
+	bool marker_based_compute(Mat &frame, double time);
+	bool marker_based_compute(Mat &frame, Mat &display, double time);
+	void set_display_time(double time);
+	bool latch_pose();
+	double get_pose_time();
 
 	int getWidth();
 	int getHeight();
+	const Mat &get_undistort_map();
 
 	mat4 get_view_matrix();
+	mat4 get_view_matrix(double display_time);
+	mat4 get_last_view_matrix();
 	mat4 get_projection_matrix();
 };
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <map>
+#include <string>
+
+// Per-frame measurements (times in ms, counters, byte counts) summarized on stdout once per interval.
+class FrameStats {
+public:
+	FrameStats(double interval = 1.0);
+	void Add(const std::string &name, double value);
+	void Report(double time);
+
+private:
+	struct Entry {
+		double sum, max;
+		int samples;
+	};
+	std::map<std::string, Entry> entries_;
+	double interval_, last_report_;
+	int frames_;
+};
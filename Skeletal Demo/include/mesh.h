@@ -11,13 +11,31 @@
 #include "shader.h"
 #include "namer.h"
 
+// With max_batch_bones > 0 the triangles are split at load into batches that reference at most that
+// many bones. The vertices of a batch are copied and their bone ids remapped to indices into the
+// batch's own bone list, so a draw only needs that sub-palette, not the whole skeleton. With 0 there
+// is one batch and the ids stay skeleton-wide.
 class Mesh {
 public:
-	Mesh(boost::filesystem::path directory_path, aiMesh *mesh, const aiScene *scene, Namer &bone_namer, std::vector<glm::mat4> &bone_offsets);
+	struct Batch {
+		uint32_t first_index, index_count;
+		// skeleton bone of each local id; empty when not partitioned
+		std::vector<int> bones;
+	};
+
+	Mesh(boost::filesystem::path directory_path, aiMesh *mesh, const aiScene *scene, Namer &bone_namer, std::vector<glm::mat4> &bone_offsets, int max_batch_bones = 0);
 	~Mesh();
-	void Draw(std::weak_ptr<Shader> shader_ptr) const;
+	// binds the diffuse texture on unit 0 and the vertex array
+	void Bind() const;
+	// draws one batch of a bound mesh; the caller has the shader in use, its sampler and palette set
+	void Draw(size_t batch) const;
+	const std::vector<Batch> &batches() const;
+	bool partitioned() const;
 
 private:
-	uint32_t vao_, vbo_, ebo_, texture_id_, indices_size_;
+	uint32_t vao_, vbo_, ebo_, texture_id_;
+	std::vector<Batch> batches_;
+	bool partitioned_;
 
+	void Partition(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices, int max_batch_bones);
 };
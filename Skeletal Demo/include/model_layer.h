@@ -0,0 +1,45 @@
+#pragma once
+#include <glad/glad.h>
+
+#include <memory>
+
+#include <glm/glm.hpp>
+
+#include "shader.h"
+
+// Off-screen color + depth target for the model. The last rendered layer can be composited again
+// with a newer view matrix (planar reprojection) when a frame misses its deadline. Begin and End
+// bracket a GL_TIME_ELAPSED query; results are read back without stalling, a frame or more later.
+class ModelLayer {
+public:
+	ModelLayer();
+	~ModelLayer();
+
+	void Begin(int width, int height);
+	void End(const glm::mat4 &view_matrix);
+	void Composite(const glm::mat4 &view_matrix, const glm::mat4 &projection_matrix);
+	bool valid() const;
+	// running average of the GPU time between Begin and End in seconds, 0 until a query came back
+	double gpu_time();
+
+private:
+	static const int kTimerQueries = 3;
+
+	uint32_t fbo_, color_texture_, depth_buffer_, vao_;
+	int width_, height_;
+	int viewport_[4];
+	bool valid_;
+	glm::mat4 layer_view_;
+	std::shared_ptr<Shader> shader_ptr_;
+	int32_t inverse_view_projection_uniform_, layer_view_projection_uniform_, plane_normal_uniform_, layer_uniform_;
+	// a ring of timer queries, the oldest at next_query_
+	uint32_t queries_[kTimerQueries];
+	bool query_pending_[kTimerQueries];
+	int next_query_;
+	bool timing_;
+	double gpu_time_;
+
+	void Resize(int width, int height);
+	// takes in every query result that is available
+	void PollQueries();
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+constexpr double kMaxPrediction = 0.1; // seconds
+
+// Filtered marker pose (OpenCV camera frame) together with the velocities used to extrapolate it.
+// Plain data, so it can be copied between threads as a whole.
+struct PoseState {
+	glm::vec3 position;
+	glm::vec3 velocity;
+	glm::quat rotation;
+	glm::vec3 angular_velocity; // rotation axis * rad/s, camera frame
+	double time;
+	bool valid;
+
+	PoseState();
+	// marker -> camera transform extrapolated to time t (clamped to kMaxPrediction ahead)
+	glm::mat4 predict(double t) const;
+};
+
+// Per-anchor pose filter. Position uses a One-Euro filter or, optionally, a constant-velocity Kalman
+// filter per axis; rotation uses a One-Euro style adaptive slerp. Both keep a velocity estimate so
+// the renderer can ask for the pose at the expected display time.
+class PoseFilter {
+public:
+	enum Mode { ONE_EURO = 0, KALMAN = 1 };
+
+	PoseFilter(Mode mode = ONE_EURO);
+	void Update(const glm::mat3 &rotation, const glm::vec3 &translation, double time);
+	void Reset();
+	glm::mat4 predict(double t) const;
+	const PoseState &state() const;
+
+	// One-Euro tuning: cutoff frequencies in Hz, beta scales the cutoff with speed
+	float min_cutoff, beta, derivative_cutoff;
+	float rotation_min_cutoff, rotation_beta;
+	// Kalman tuning: acceleration noise density and measurement variance
+	float process_noise, measurement_noise;
+
+private:
+	Mode mode_;
+	PoseState state_;
+	float covariance_[3][3]; // per axis: P00, P01, P11
+
+	void UpdatePositionOneEuro(const glm::vec3 &translation, float dt);
+	void UpdatePositionKalman(const glm::vec3 &translation, float dt);
+	void UpdateRotation(const glm::quat &rotation, float dt);
+};
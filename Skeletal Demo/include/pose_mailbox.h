@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Single-writer seqlock mailbox. The writer never waits; a reader that overlaps a write retries,
+// so the reader always gets the newest complete value without taking a lock.
+template <typename T>
+class PoseMailbox {
+public:
+	static_assert(std::is_trivially_copyable<T>::value, "PoseMailbox needs a trivially copyable type");
+
+	PoseMailbox() : sequence_(0) {
+		for (auto &word : words_) word.store(0, std::memory_order_relaxed);
+	}
+
+	void Publish(const T &value) {
+		uint32_t buffer[kWords] = {};
+		std::memcpy(buffer, &value, sizeof(T));
+
+		uint32_t sequence = sequence_.load(std::memory_order_relaxed);
+		sequence_.store(sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		for (int i = 0; i < kWords; i++) words_[i].store(buffer[i], std::memory_order_relaxed);
+		sequence_.store(sequence + 2, std::memory_order_release);
+	}
+
+	// returns false until something has been published
+	bool Read(T &value) const {
+		uint32_t buffer[kWords];
+		uint32_t before, after;
+		do {
+			before = sequence_.load(std::memory_order_acquire);
+			for (int i = 0; i < kWords; i++) buffer[i] = words_[i].load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			after = sequence_.load(std::memory_order_relaxed);
+		} while ((before & 1) || before != after);
+		if (before == 0) return false;
+		std::memcpy(&value, buffer, sizeof(T));
+		return true;
+	}
+
+private:
+	static constexpr int kWords = (int)((sizeof(T) + sizeof(uint32_t) - 1) / sizeof(uint32_t));
+
+	std::atomic<uint32_t> sequence_;
+	std::atomic<uint32_t> words_[kWords];
+};
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+// Picks the detection resolution from a list of levels (largest first) so that the per-frame
+// detection cost stays inside a budget. Steps down when the smoothed cost exceeds the budget and
+// back up when there is clear headroom; after every switch the level is held for a while so a
+// single slow frame cannot make it oscillate.
+class ResolutionController {
+public:
+	ResolutionController() = delete;
+	ResolutionController(const std::vector<cv::Size> &levels, double budget);
+	// feed the cost of one frame in seconds; returns true if the level changed
+	bool Update(double cost);
+	cv::Size size() const;
+	int level() const;
+
+	// fractions of the budget: step down above step_down, up below step_up
+	float step_down, step_up;
+	// frames to wait after a switch before the next one
+	int hold_frames;
+
+private:
+	std::vector<cv::Size> levels_;
+	double budget_, average_;
+	int level_, frames_since_switch_;
+};
@@ -2,21 +2,43 @@
 #define SHADER_H
 
 #include <string>
+#include <vector>
 #include <boost/filesystem.hpp>
 
+// Every active uniform is looked up once after linking and kept in a table sorted by name. Draw
+// code resolves the names it needs to handles up front (Uniform) and sets through them, which is an
+// index into the table. Setting by name still works but searches the table and is counted in
+// string_lookups(), so per-frame callers that still do it show up.
 class Shader {
 public:
 	Shader() = delete;
 	Shader(boost::filesystem::path vs_path, boost::filesystem::path fs_path);
 	Shader(std::string vs_source, std::string fs_source);
 	void Use() const;
+	// -1 for a name that is not an active uniform (optimized out or misspelled); setting it is a no-op
+	int32_t Uniform(const std::string &identifier) const;
+	template <typename T> void SetUniform(int32_t handle, const T&) const;
 	template <typename T> void SetUniform(const std::string &identifier, const T&) const;
+	// SetUniform calls by name, for this shader and for all shaders
+	int string_lookups() const;
+	static int total_string_lookups();
 
 private:
+	struct ActiveUniform {
+		std::string name;
+		int32_t location, size;
+		uint32_t type;
+	};
+
 	static uint32_t Compile(uint32_t type, const std::string &source, boost::filesystem::path path);
 	static uint32_t Link(uint32_t vs_id, uint32_t fs_id);
+	void Reflect();
+	int32_t Location(int32_t handle) const;
 
 	uint32_t id;
+	std::vector<ActiveUniform> uniforms_;
+	mutable int string_lookups_;
+	static int total_string_lookups_;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <assimp/scene.h>
+#include <glm/glm.hpp>
+
+#include "namer.h"
+
+// The node hierarchy of a scene flattened at load into an array in which every parent comes before
+// its children. Each node keeps its parent's index, its rest transform, its channel in each
+// animation (-1 if it is not animated) and its bone (-1 if it is none). A pose is one loop over the
+// array that reads the parent's global transform from an earlier slot: no recursion, no strings,
+// no map lookups.
+//
+// Each channel keeps a cursor on the key interval it sampled last. Playback moves forward, so the
+// next sample is found by stepping from there, usually zero or one keys; only a jump backwards or
+// far ahead (a seek, the clip looping) falls back to a binary search. One skeleton per instance,
+// the cursors are its playback state.
+class Skeleton {
+public:
+	Skeleton(aiNode *root, aiAnimation **animations, uint32_t animation_count, Namer &bone_namer);
+
+	// bone_matrices[bone] = global transform of the bone's node * bone_offsets[bone]
+	void Evaluate(uint32_t animation_id, double ticks, const std::vector<glm::mat4> &bone_offsets, std::vector<glm::mat4> &bone_matrices);
+	int size() const;
+
+	// time per update of the former recursive, string-keyed evaluation against Evaluate, on the given
+	// hierarchy and on a generated rig of the given number of bones
+	static void Benchmark(const std::string &name, aiNode *root, aiAnimation **animations, uint32_t animation_count,
+		Namer &bone_namer, const std::vector<glm::mat4> &bone_offsets, int frames);
+	static void Benchmark(int bones, int frames);
+	// time per sample of a forward sweep through one channel, cursor against binary search, for clips
+	// of increasing length
+	static void BenchmarkSampling(int samples);
+
+private:
+	struct Node {
+		int parent, bone;
+		glm::mat4 rest;
+		// channel index in each animation
+		std::vector<int> channels;
+	};
+	// left key of the last sampled interval, per key array of a channel
+	struct Cursor {
+		uint32_t position, rotation, scaling;
+	};
+	// keys stepped over linearly before giving up on the cursor
+	static const uint32_t kMaxCursorSteps = 4;
+
+	void Flatten(aiNode *node, int parent, const std::vector<std::map<std::string, int>> &channel_maps, Namer &bone_namer);
+	// the evaluation this replaces, kept as the reference for Benchmark
+	static void EvaluateRecursively(aiAnimation *animation, uint32_t animation_id, aiNode *node, glm::mat4 transform, double ticks,
+		std::map<std::pair<uint32_t, std::string>, uint32_t> &channel_map, Namer &bone_namer,
+		const std::vector<glm::mat4> &bone_offsets, std::vector<glm::mat4> &bone_matrices);
+
+	// the key interval [i, i + 1] holding ticks, for keys[0].mTime < ticks < keys[n - 1].mTime; a
+	// null cursor always searches
+	template <typename Key> static uint32_t FindKey(const Key *keys, uint32_t n, double ticks, uint32_t *cursor);
+	static glm::mat4 InterpolateTranslationMatrix(aiVectorKey *keys, uint32_t n, double ticks, uint32_t *cursor = nullptr);
+	static glm::mat4 InterpolateRotationMatrix(aiQuatKey *keys, uint32_t n, double ticks, uint32_t *cursor = nullptr);
+	static glm::mat4 InterpolateScalingMatrix(aiVectorKey *keys, uint32_t n, double ticks, uint32_t *cursor = nullptr);
+
+	std::vector<aiAnimation *> animations_;
+	std::vector<Node> nodes_;
+	std::vector<glm::mat4> transforms_;
+	std::vector<Cursor> cursors_;
+	uint32_t cursor_animation_;
+};
@@ -7,7 +7,9 @@
 #include <assimp/scene.h>
 #include <glm/glm.hpp>
 
+#include "bone_palette.h"
 #include "mesh.h"
+#include "skeleton.h"
 #include "shader.h"
 #include "camera.h"
 #include "namer.h"
@@ -15,25 +17,40 @@
 class SpriteModel {
 public:
 	SpriteModel() = delete;
-	SpriteModel(boost::filesystem::path path);
+	// max_batch_bones > 0 splits the meshes into batches with their own sub-palettes (see Mesh)
+	SpriteModel(boost::filesystem::path path, int max_batch_bones = 0);
 	~SpriteModel();
 	void Draw(std::weak_ptr<Camera> camera_ptr);
 	void Draw(uint32_t animation_id, std::weak_ptr<Camera> camera_ptr, double time);
+	// bone matrices written for the last Draw
+	size_t bone_upload_bytes() const;
+	// draw calls per Draw
+	int draw_count() const;
+	// skeleton evaluation in the last animated Draw
+	double bone_update_ms() const;
+	// prints the time per skeleton update before and after flattening
+	void Benchmark(int frames);
 
 private:
 	boost::filesystem::path directory_path_;
 	std::vector<std::shared_ptr<Mesh>> mesh_ptrs_;
 	const aiScene *scene_;
 	std::shared_ptr<Shader> shader_ptr_;
+	int32_t model_matrix_uniform_, view_matrix_uniform_, projection_matrix_uniform_, diffuse_texture_uniform_;
+	int32_t bone_palette_uniform_, bone_palette_base_uniform_;
+	std::unique_ptr<BonePalette> bone_palette_ptr_;
+	int max_batch_bones_, draw_count_;
+	// palette base of every batch of every mesh in draw order (-1 if it did not fit), and the gathered sub-palette
+	std::vector<int> batch_bases_;
+	bool palette_overflow_logged_;
+	std::vector<glm::mat4> batch_palette_;
 	Namer bone_namer_;
 	std::vector<glm::mat4> bone_matrices_, bone_offsets_;
-	std::map<std::pair<uint32_t, std::string>, uint32_t> animation_channel_map_;
+	std::unique_ptr<Skeleton> skeleton_ptr_;
+	double bone_update_ms_;
 
 	void RecursivelyInitNodes(aiNode *node);
-	void RecursivelyUpdateBoneMatrices(int animation_id, aiNode *node, glm::mat4 transform, double ticks);
-
-	static glm::mat4 InterpolateTranslationMatrix(aiVectorKey *keys, uint32_t n, double ticks);
-	static glm::mat4 InterpolateRotationMatrix(aiQuatKey *keys, uint32_t n, double ticks);
-	static glm::mat4 InterpolateScalingMatrix(aiVectorKey *keys, uint32_t n, double ticks);
+	void UploadBoneMatrices();
+	void DrawMeshes();
 };
 
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+// Both IPPE solutions for one square marker, sorted so that [0] has the lower reprojection error (pixels, RMS).
+struct SquarePose {
+	cv::Matx33d rotation[2];
+	cv::Vec3d translation[2];
+	double reprojection_error[2];
+};
+
+// Closed-form IPPE pose solver for square markers (Collins & Bartoli, "Infinitesimal Plane-based Pose Estimation").
+// All markers of a frame are solved as one batch: the corners are undistorted with a single call and the
+// per-marker math runs over structure-of-arrays buffers in branch-free loops that the compiler vectorizes.
+// Corner order follows aruco: top-left, top-right, bottom-right, bottom-left.
+class SquarePoseSolver {
+public:
+	SquarePoseSolver() = delete;
+	SquarePoseSolver(double marker_length);
+	void Solve(const std::vector<std::vector<cv::Point2f>> &corners, const cv::Mat &camera_matrix, const cv::Mat &dist_coeffs, std::vector<SquarePose> &poses);
+
+private:
+	double half_length_;
+	std::vector<cv::Point2f> distorted_, undistorted_;
+	std::vector<double> soa_;
+};
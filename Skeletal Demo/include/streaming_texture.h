@@ -0,0 +1,69 @@
+#pragma once
+
+#include <vector>
+
+#include <glad/glad.h>
+
+#include <opencv2/core.hpp>
+
+// A texture that is refilled with a new image every frame. The storage is allocated once, immutable
+// through glTexStorage2D where the context has it, and only reallocated when the image size or type
+// changes; every frame is a glTexSubImage2D into the same level 0. There are no mipmaps, the image
+// is drawn about 1:1. BGR(A) images are uploaded as RGB(A) and put in order by the texture's swizzle,
+// so the driver never has to reorder the bytes.
+//
+// With PIXEL_BUFFER the image is first written into the next buffer of a small ring of pixel unpack
+// buffers and the texture is updated from there, so the driver does not have to copy client memory
+// or wait for the GPU inside glTexSubImage2D. Each buffer carries a fence; a buffer the GPU has not
+// finished reading is orphaned instead of waited on.
+//
+// PERSISTENT (GL 4.4 / ARB_buffer_storage) keeps one buffer with a slot per ring entry mapped for
+// the lifetime of the texture, so a frame is a memcpy and no map/unmap. A slot is reused once its
+// fence has signalled. Without buffer storage it falls back to PIXEL_BUFFER, and to DIRECT if
+// buffers cannot be mapped at all.
+class StreamingTexture {
+public:
+	enum Upload { DIRECT = 0, PIXEL_BUFFER = 1, PERSISTENT = 2 };
+
+	StreamingTexture(Upload upload = DIRECT, int buffers = 3);
+	~StreamingTexture();
+	StreamingTexture(const StreamingTexture &) = delete;
+	StreamingTexture &operator=(const StreamingTexture &) = delete;
+
+	// image: CV_8UC1, CV_8UC2, CV_8UC3 (BGR) or CV_8UC4 (BGRA); leaves the texture bound on the active unit
+	void Update(const cv::Mat &image);
+	void Bind() const;
+	unsigned int id() const;
+	cv::Size size() const;
+	// the path actually in use after falling back
+	Upload upload() const;
+	// storage (re)allocations so far, stays at 1 while the camera resolution does not change
+	int allocations() const;
+	// buffers still read by the GPU when their turn came: orphaned (PIXEL_BUFFER) or waited on (PERSISTENT)
+	int busy_buffers() const;
+
+	static bool HasImmutableStorage();
+	static bool HasBufferStorage();
+	static const char *Name(Upload upload);
+	// uploads frames of the given size through every available path and prints the CPU time per
+	// upload and the time until the GPU has the texture
+	static void Benchmark(cv::Size size, int frames, int buffers);
+
+private:
+	void Allocate(int width, int height, int type);
+	bool AllocateBuffers(int width, int height, int type);
+	void ReleaseBuffers();
+	void UpdateFromBuffer(const cv::Mat &image, GLenum format);
+
+	unsigned int texture_;
+	int width_, height_, type_;
+	int allocations_;
+
+	Upload upload_;
+	// PIXEL_BUFFER: one buffer per slot; PERSISTENT: buffers_[0] holds every slot
+	std::vector<unsigned int> buffers_;
+	std::vector<GLsync> fences_;
+	unsigned char *mapped_;
+	size_t image_size_, slot_size_;
+	int next_slot_, busy_buffers_;
+};
@@ -1,7 +1,5 @@
 #version 410 core
 
-const int MAX_BONES = 100;
-
 layout (location = 0) in vec3 aPosition;
 layout (location = 1) in vec2 aTexCoord;
 layout (location = 2) in vec3 aNormal;
@@ -17,13 +15,23 @@ out vec3 vNormal;
 uniform mat4 uModelMatrix;
 uniform mat4 uViewMatrix;
 uniform mat4 uProjectionMatrix;
-uniform mat4 uBoneMatrices[MAX_BONES];
+// three RGBA32F texels per bone, the rows of its affine 3x4 matrix
+uniform samplerBuffer uBonePalette;
+uniform int uBonePaletteBase;
+
+mat4 BoneMatrix(int id) {
+    int texel = uBonePaletteBase + id * 3;
+    vec4 row0 = texelFetch(uBonePalette, texel);
+    vec4 row1 = texelFetch(uBonePalette, texel + 1);
+    vec4 row2 = texelFetch(uBonePalette, texel + 2);
+    return transpose(mat4(row0, row1, row2, vec4(0, 0, 0, 1)));
+}
 
 mat4 CalcBoneMatrix() {
     mat4 boneMatrix = mat4(0);
     for (int i = 0; i < 4; i++) {
-        boneMatrix += uBoneMatrices[aBoneIDs0[i]] * aBoneWeights0[i];
-        boneMatrix += uBoneMatrices[aBoneIDs1[i]] * aBoneWeights1[i];
+        boneMatrix += BoneMatrix(aBoneIDs0[i]) * aBoneWeights0[i];
+        boneMatrix += BoneMatrix(aBoneIDs1[i]) * aBoneWeights1[i];
     }
     return boneMatrix;
 }
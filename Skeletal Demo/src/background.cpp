@@ -1,89 +1,233 @@
 #include "background.h"
 
-Background::Background()
+Background::Background(StreamingTexture::Upload upload, int buffers) : texture_(upload, buffers), chroma_(upload, buffers), format_(BGR)
 {
+	// one triangle covering the screen, corners from gl_VertexID; v runs downwards so the first
+	// image row, uploaded first, lands at the top without flipping the frame
 	string vs_source = 
 		"#version 330 core\n"
-		"layout(location = 0) in vec3 aPos;\n"
-		"layout(location = 1) in vec2 aTexCoord;\n"
 		"out vec2 TexCoord;\n"
 		"void main()\n"
 		"{\n"
-		"	gl_Position = vec4(aPos, 1.0);\n"
-		"	TexCoord = vec2(aTexCoord.x, aTexCoord.y);\n"
+		"	vec2 p = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);\n"
+		"	gl_Position = vec4(p * 2.0 - 1.0, 0.0, 1.0);\n"
+		"	TexCoord = vec2(p.x, 1.0 - p.y);\n"
 		"}\n";
 	string fs_source =
 		"#version 330 core\n"
 		"out vec4 FragColor;\n"
 		"in vec2 TexCoord;\n"
 		"uniform sampler2D texture1;\n"
+		"uniform sampler2D undistort_map;\n"
+		"uniform int undistort;\n"
+		"uniform sampler2D chroma;\n"
+		"uniform int format;\n"// 0 BGR, 1 NV12, 2 YUYV
+		"vec3 yuv_to_rgb(float y, vec2 c)\n"// BT.601, video range
+		"{\n"
+		"	y = 1.164 * (y - 0.0625);\n"
+		"	c -= 0.5;\n"
+		"	return clamp(vec3(y + 1.596 * c.y, y - 0.392 * c.x - 0.813 * c.y, y + 2.017 * c.x), 0.0, 1.0);\n"
+		"}\n"
 		"void main()\n"
 		"{\n"
-		"	FragColor = texture(texture1, TexCoord);\n"
+		"	vec2 uv = TexCoord;\n"
+		"	if (undistort != 0)\n"
+		"	{\n"
+		"		uv = texture(undistort_map, TexCoord).xy;\n"
+		"		if (any(lessThan(uv, vec2(0.0))) || any(greaterThan(uv, vec2(1.0))))\n"
+		"		{\n"
+		"			FragColor = vec4(0.0, 0.0, 0.0, 1.0);\n"
+		"			return;\n"
+		"		}\n"
+		"	}\n"
+		"	if (format == 0)\n"
+		"	{\n"
+		"		FragColor = texture(texture1, uv);\n"
+		"		return;\n"
+		"	}\n"
+		"	if (format == 1)\n"
+		"	{\n"
+		"		FragColor = vec4(yuv_to_rgb(texture(texture1, uv).r, texture(chroma, uv).rg), 1.0);\n"
+		"		return;\n"
+		"	}\n"
+		"	ivec2 size = textureSize(texture1, 0);\n"// Y0 U Y1 V as RG texels: Y in r, U / V in g of even / odd texels
+		"	ivec2 p = clamp(ivec2(uv * vec2(size)), ivec2(0), size - 1);\n"
+		"	int x0 = p.x - p.x % 2;\n"
+		"	vec2 c = vec2(texelFetch(texture1, ivec2(x0, p.y), 0).g, texelFetch(texture1, ivec2(x0 + 1, p.y), 0).g);\n"
+		"	FragColor = vec4(yuv_to_rgb(texelFetch(texture1, p, 0).r, c), 1.0);\n"
 		"}\n";
 	shader_ptr_= std::make_shared<Shader>(vs_source, fs_source);
+	undistort_uniform_ = shader_ptr_->Uniform("undistort");
+	format_uniform_ = shader_ptr_->Uniform("format");
+	chroma_uniform_ = shader_ptr_->Uniform("chroma");
+	undistort_map_uniform_ = shader_ptr_->Uniform("undistort_map");
+	map_texture_ = 0;
 
-	vector<float> vertices = {
-		1.0f,  1.0f, 0.0f,   1.0f, 1.0f, // top right
-		1.0f, -1.0f, 0.0f,   1.0f, 0.0f, // bottom right
-		-1.0f, -1.0f, 0.0f,   0.0f, 0.0f, // bottom left
-		-1.0f,  1.0f, 0.0f,   0.0f, 1.0f  // top left 
-	};
-
-	vector<unsigned int> indices = {
-		0, 1, 3, // first triangle
-		1, 2, 3  // second triangle
-	};
-
+	// no vertex data, but the core profile still wants a vertex array bound to draw
 	glGenVertexArrays(1, &VAO);
-	glGenBuffers(1, &VBO);
-	glGenBuffers(1, &EBO);
-
-	glBindVertexArray(VAO);
-
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);
-	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), &vertices[0], GL_STATIC_DRAW);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
-
-	// position attribute
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
-	// texture coord attribute
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
 }
 
 Background::~Background()
 {
-	glDeleteBuffers(1, &VAO);
-	glDeleteBuffers(1, &VBO);
-	glDeleteBuffers(1, &EBO);
+	glDeleteVertexArrays(1, &VAO);
+	if (map_texture_)
+		glDeleteTextures(1, &map_texture_);
 }
 
-void Background::Draw(Mat &frame)
+// map: CV_32FC2, one texture coordinate into the camera texture per output texel
+void Background::SetUndistortMap(const Mat &map)
 {
-	unsigned int texture;
-	glGenTextures(1, &texture);
-	glBindTexture(GL_TEXTURE_2D, texture);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	if (!map_texture_)
+		glGenTextures(1, &map_texture_);
+	glBindTexture(GL_TEXTURE_2D, map_texture_);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, map.cols, map.rows, 0, GL_RG, GL_FLOAT, map.data);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void Background::SetFormat(Format format, Size size)
+{
+	format_ = format;
+	frame_size_ = size;
+}
+
+Background::Format Background::ParseFormat(const string &name)
+{
+	if (name == "NV12")
+		return NV12;
+	if (name == "YUYV")
+		return YUYV;
+	return BGR;
+}
+
+bool Background::IsRaw(const Mat &raw, Format format, Size size)
+{
+	size_t bytes = format == NV12 ? (size_t)size.area() * 3 / 2 : (size_t)size.area() * 2;
+	return format != BGR && !raw.empty() && raw.isContinuous() && raw.total() * raw.elemSize() == bytes;
+}
+
+bool Background::Planes(const Mat &raw, Format format, Size size, Mat &luma, Mat &chroma)
+{
+	if (!IsRaw(raw, format, size))
+		return false;
+	if (format == NV12)
+	{
+		// full resolution Y plane followed by half resolution interleaved UV
+		luma = Mat(size, CV_8UC1, raw.data);
+		chroma = Mat(size.height / 2, size.width / 2, CV_8UC2, raw.data + size.area());
+	}
+	else
+	{
+		// Y0 U Y1 V: Y is every first byte of a pair
+		chroma = Mat(size, CV_8UC2, raw.data);
+		extractChannel(chroma, luma, 0);
+	}
+	return true;
+}
 
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, frame.cols, frame.rows, 0, GL_BGR, GL_UNSIGNED_BYTE, frame.data);
-	glGenerateMipmap(GL_TEXTURE_2D);
+void Background::Upload(const Mat &frame, Format format, Size size, StreamingTexture &texture, StreamingTexture &chroma)
+{
+	glActiveTexture(GL_TEXTURE0);
+	if (format == BGR)
+		texture.Update(frame);
+	else if (!IsRaw(frame, format, size))
+		return;
+	else if (format == YUYV)
+		texture.Update(Mat(size, CV_8UC2, frame.data));
+	else
+	{
+		texture.Update(Mat(size, CV_8UC1, frame.data));
+		chroma.Update(Mat(size.height / 2, size.width / 2, CV_8UC2, frame.data + size.area()));
+	}
+}
+
+// same texture every frame, only the pixels are replaced (issue#2)
+void Background::Update(const Mat &frame)
+{
+	Upload(frame, format_, frame_size_, texture_, chroma_);
+}
+
+const StreamingTexture &Background::texture() const
+{
+	return texture_;
+}
+
+void Background::Draw()
+{
+	Draw(texture_.id(), chroma_.id());
+}
 
+void Background::Draw(unsigned int texture, unsigned int chroma)
+{
+	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, texture);
 
 	glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 	shader_ptr_->Use();
+	shader_ptr_->SetUniform<int32_t>(undistort_uniform_, map_texture_ ? 1 : 0);
+	shader_ptr_->SetUniform<int32_t>(format_uniform_, (int32_t)format_);
+	if (format_ == NV12)
+	{
+		shader_ptr_->SetUniform<int32_t>(chroma_uniform_, 2);
+		glActiveTexture(GL_TEXTURE2);
+		glBindTexture(GL_TEXTURE_2D, chroma);
+		glActiveTexture(GL_TEXTURE0);
+	}
+	if (map_texture_)
+	{
+		shader_ptr_->SetUniform<int32_t>(undistort_map_uniform_, 1);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, map_texture_);
+		glActiveTexture(GL_TEXTURE0);
+	}
 
 	glBindVertexArray(VAO);
-	glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-	
-	// see issue#2
-	// glDeleteTextures(1, &texture);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+}
+
+// the former path (cv::flip, GL_BGR upload into a mipmapped texture, glGenerateMipmap) against the
+// current one; glFinish after each frame so work the driver defers is counted too
+void Background::Benchmark(Size size, int frames)
+{
+	Mat images[2] = { Mat(size, CV_8UC3, Scalar(40, 80, 120)), Mat(size, CV_8UC3, Scalar(200, 160, 120)) };
+	Mat flipped;
+	double tick = 1000.0 / getTickFrequency();
+
+	unsigned int texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, size.width, size.height, 0, GL_BGR, GL_UNSIGNED_BYTE, NULL);
+	double flip_ms = 0, upload_ms = 0;
+	for (int i = 0; i < frames; i++)
+	{
+		int64_t start = getTickCount();
+		cv::flip(images[i & 1], flipped, 0);
+		int64_t flipped_at = getTickCount();
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, size.width, size.height, GL_BGR, GL_UNSIGNED_BYTE, flipped.data);
+		glGenerateMipmap(GL_TEXTURE_2D);
+		glFinish();
+		flip_ms += (flipped_at - start) * tick;
+		upload_ms += (getTickCount() - flipped_at) * tick;
+	}
+	glDeleteTextures(1, &texture);
+
+	StreamingTexture streaming;
+	double streaming_ms = 0;
+	for (int i = 0; i < frames; i++)
+	{
+		int64_t start = getTickCount();
+		streaming.Update(images[i & 1]);
+		glFinish();
+		streaming_ms += (getTickCount() - start) * tick;
+	}
+
+	cout << "[background] " << size.width << "x" << size.height << " before: flip " << flip_ms / frames << " ms + upload and mipmaps "
+		<< upload_ms / frames << " ms, now: " << streaming_ms / frames << " ms, saved " << (flip_ms + upload_ms - streaming_ms) / frames << " ms/frame" << endl;
 }
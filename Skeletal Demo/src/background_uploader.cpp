@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <iostream>
+
+#include "background_uploader.h"
+
+BackgroundUploader::BackgroundUploader(GLFWwindow *window, Background::Format format, cv::Size size,
+	StreamingTexture::Upload upload, int buffers, int pool)
+	: context_(NULL), format_(format), size_(size), upload_(upload), buffers_(buffers),
+	has_pending_(false), running_(true), ready_(-1), shown_(-1), dropped_(0) {
+	// an invisible window only for its context, which shares textures and fences with window
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	context_ = glfwCreateWindow(1, 1, "uploader", NULL, window);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+	if (!context_) {
+		std::cout << "could not create a shared context, uploading on the render thread" << std::endl;
+		return;
+	}
+
+	// one shown, one ready, one being written
+	slots_.resize(std::max(pool, 3));
+	for (Slot &slot : slots_) {
+		slot.texture.reset(new StreamingTexture(upload_, buffers_));
+		slot.chroma.reset(new StreamingTexture(upload_, buffers_));
+		slot.ready_fence = slot.release_fence = 0;
+		slot.state = FREE;
+		slot.upload_ms = 0;
+	}
+	thread_ = std::thread(&BackgroundUploader::Run, this);
+}
+
+BackgroundUploader::~BackgroundUploader() {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		running_ = false;
+	}
+	pending_cv_.notify_all();
+	if (thread_.joinable()) thread_.join();
+	if (context_) glfwDestroyWindow(context_);
+}
+
+bool BackgroundUploader::valid() const {
+	return context_ != NULL;
+}
+
+void BackgroundUploader::Submit(cv::Mat &frame) {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (has_pending_) dropped_++;
+		std::swap(pending_, frame);
+		has_pending_ = true;
+	}
+	pending_cv_.notify_one();
+}
+
+// under mutex_; there is always a free slot with three or more, the ready one is only taken back
+// as a safety net
+int BackgroundUploader::TakeSlot() {
+	for (size_t i = 0; i < slots_.size(); i++) {
+		if (slots_[i].state == FREE) return (int)i;
+	}
+	int index = ready_;
+	ready_ = -1;
+	dropped_++;
+	return index;
+}
+
+void BackgroundUploader::Run() {
+	glfwMakeContextCurrent(context_);
+	cv::Mat frame;
+	while (true) {
+		int index;
+		GLsync release_fence;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			pending_cv_.wait(lock, [this] { return has_pending_ || !running_; });
+			if (!running_) break;
+			std::swap(frame, pending_);
+			has_pending_ = false;
+			index = TakeSlot();
+			slots_[index].state = UPLOADING;
+			release_fence = slots_[index].release_fence;
+			slots_[index].release_fence = 0;
+		}
+
+		Slot &slot = slots_[index];
+		// the render context may still be sampling these textures from the last time they were shown
+		if (release_fence) {
+			glWaitSync(release_fence, 0, GL_TIMEOUT_IGNORED);
+			glDeleteSync(release_fence);
+		}
+		double start = glfwGetTime();
+		Background::Upload(frame, format_, size_, *slot.texture, *slot.chroma);
+		if (slot.ready_fence) glDeleteSync(slot.ready_fence);
+		slot.ready_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		// the fence has to reach the GPU before the other context waits on it
+		glFlush();
+		slot.upload_ms = (glfwGetTime() - start) * 1000.0;
+
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (ready_ >= 0) {
+			slots_[ready_].state = FREE;
+			dropped_++;
+		}
+		slot.state = READY;
+		ready_ = index;
+	}
+
+	for (Slot &slot : slots_) {
+		if (slot.ready_fence) glDeleteSync(slot.ready_fence);
+		if (slot.release_fence) glDeleteSync(slot.release_fence);
+		slot.texture.reset();
+		slot.chroma.reset();
+	}
+	glfwMakeContextCurrent(NULL);
+}
+
+bool BackgroundUploader::Acquire(unsigned int &texture, unsigned int &chroma, double &upload_ms) {
+	std::lock_guard<std::mutex> lock(mutex_);
+	upload_ms = -1;
+	if (ready_ >= 0) {
+		// everything drawn from the old frame so far has to finish before the uploader reuses it
+		if (shown_ >= 0) {
+			Slot &old = slots_[shown_];
+			if (old.release_fence) glDeleteSync(old.release_fence);
+			old.release_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			old.state = FREE;
+		}
+		shown_ = ready_;
+		ready_ = -1;
+		Slot &slot = slots_[shown_];
+		slot.state = SHOWN;
+		upload_ms = slot.upload_ms;
+		// a GPU side wait, the render thread itself does not block
+		glWaitSync(slot.ready_fence, 0, GL_TIMEOUT_IGNORED);
+	}
+	if (shown_ < 0) return false;
+	texture = slots_[shown_].texture->id();
+	chroma = slots_[shown_].chroma->id();
+	return true;
+}
+
+int BackgroundUploader::dropped() const {
+	std::lock_guard<std::mutex> lock(mutex_);
+	return dropped_;
+}
@@ -0,0 +1,118 @@
+#include <algorithm>
+
+#include "bone_palette.h"
+
+BonePalette::BonePalette(int capacity, int segments)
+	: buffer_(0), texture_(0), requested_(0), segment_(-1), used_(0), busy_segments_(0), mapped_(NULL) {
+	fences_.assign(std::max(segments, 1), (GLsync)0);
+	GLint max_texels = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+	max_capacity_ = std::max(max_texels / (kTexelsPerBone * (int)fences_.size()), 1);
+
+	glGenBuffers(1, &buffer_);
+	glGenTextures(1, &texture_);
+	Allocate(capacity);
+}
+
+BonePalette::~BonePalette() {
+	for (GLsync fence : fences_) {
+		if (fence) glDeleteSync(fence);
+	}
+	glDeleteTextures(1, &texture_);
+	glDeleteBuffers(1, &buffer_);
+}
+
+void BonePalette::Allocate(int capacity) {
+	for (GLsync &fence : fences_) {
+		if (fence) glDeleteSync(fence);
+		fence = 0;
+	}
+	capacity_ = std::max(std::min(capacity, max_capacity_), 1);
+	segment_size_ = (size_t)capacity_ * kTexelsPerBone * sizeof(glm::vec4);
+	segment_ = -1;
+
+	// new storage for the buffer object; the driver keeps the old one alive for draws still reading it
+	glBindBuffer(GL_TEXTURE_BUFFER, buffer_);
+	glBufferData(GL_TEXTURE_BUFFER, segment_size_ * fences_.size(), NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	glBindTexture(GL_TEXTURE_BUFFER, texture_);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer_);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+void BonePalette::Begin() {
+	if (requested_ > capacity_ && capacity_ < max_capacity_) {
+		// the last frame did not fit; leave room to grow so a slowly rising count does not reallocate every frame
+		Allocate(std::max(requested_, capacity_ + capacity_ / 2));
+	} else if (segment_ >= 0) {
+		// everything drawn since the last Begin reads the previous segment
+		if (fences_[segment_]) glDeleteSync(fences_[segment_]);
+		fences_[segment_] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+	segment_ = (segment_ + 1) % (int)fences_.size();
+	used_ = 0;
+	requested_ = 0;
+
+	GLsync fence = fences_[segment_];
+	if (fence) {
+		if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+			busy_segments_++;
+			while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {
+			}
+		}
+		glDeleteSync(fence);
+		fences_[segment_] = 0;
+	}
+
+	// the fence says the GPU is done with the segment, so the driver need not synchronize
+	glBindBuffer(GL_TEXTURE_BUFFER, buffer_);
+	mapped_ = (glm::vec4 *)glMapBufferRange(GL_TEXTURE_BUFFER, segment_ * segment_size_, segment_size_,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+int BonePalette::Add(const std::vector<glm::mat4> &matrices) {
+	return Add(matrices.data(), (int)matrices.size());
+}
+
+int BonePalette::Add(const glm::mat4 *matrices, int count) {
+	requested_ += count;
+	if (!mapped_ || used_ + count > capacity_) return -1;
+	glm::vec4 *target = mapped_ + used_ * kTexelsPerBone;
+	for (int i = 0; i < count; i++) {
+		// glm is column major, the rows of the upper 3x4 go out as texels
+		const glm::mat4 &m = matrices[i];
+		for (int r = 0; r < kTexelsPerBone; r++) target[r] = glm::vec4(m[0][r], m[1][r], m[2][r], m[3][r]);
+		target += kTexelsPerBone;
+	}
+	int base = segment_ * capacity_ * kTexelsPerBone + used_ * kTexelsPerBone;
+	used_ += count;
+	return base;
+}
+
+void BonePalette::End() {
+	if (!mapped_) return;
+	glBindBuffer(GL_TEXTURE_BUFFER, buffer_);
+	glUnmapBuffer(GL_TEXTURE_BUFFER);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	mapped_ = NULL;
+}
+
+void BonePalette::Bind(int unit) const {
+	glActiveTexture(GL_TEXTURE0 + unit);
+	glBindTexture(GL_TEXTURE_BUFFER, texture_);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+int BonePalette::capacity() const {
+	return capacity_;
+}
+
+size_t BonePalette::uploaded_bytes() const {
+	return (size_t)used_ * kTexelsPerBone * sizeof(glm::vec4);
+}
+
+int BonePalette::busy_segments() const {
+	return busy_segments_;
+}
@@ -2,45 +2,145 @@
 
 #define MarkerLength 1.75
 
-void Camera::setProjection()
+// pixel coordinates from one resolution of the sensor to another, pixel centers aligned
+static void map_corners(const vector< vector<cv::Point2f> > &corners, Size from, Size to, vector< vector<cv::Point2f> > &mapped)
+{
+	float sx = (float)to.width / from.width;
+	float sy = (float)to.height / from.height;
+	mapped.resize(corners.size());
+	for (size_t i = 0; i < corners.size(); i++)
+	{
+		mapped[i].resize(corners[i].size());
+		for (size_t k = 0; k < corners[i].size(); k++)
+			mapped[i][k] = cv::Point2f((corners[i][k].x + 0.5f) * sx - 0.5f, (corners[i][k].y + 0.5f) * sy - 0.5f);
+	}
+}
+
+void Camera::setProjection(Intrinsics &intrinsics)
 {
 	float farp = 100, nearp = 0.1;
-	projection_matrix_= Mat::zeros(4, 4, CV_32F);
+	Mat &projection_matrix = intrinsics.projection_matrix;
+	projection_matrix = Mat::zeros(4, 4, CV_32F);
+
+	float f_x = intrinsics.camera_matrix.at<double>(0, 0);
+	float f_y = intrinsics.camera_matrix.at<double>(1, 1);
+
+	float c_x = intrinsics.camera_matrix.at<double>(0, 2);
+	float c_y = intrinsics.camera_matrix.at<double>(1, 2);
+
+	float width = (float)intrinsics.size.width;
+	float height = (float)intrinsics.size.height;
 
-	float f_x = camera_matrix_.at<double>(0, 0);
-	float f_y = camera_matrix_.at<double>(1, 1);
+	projection_matrix.at<float>(0, 0) = 2 * f_x / width;
+	projection_matrix.at<float>(1, 1) = 2 * f_y / height;
 
-	float c_x = camera_matrix_.at<double>(0, 2);
-	float c_y = camera_matrix_.at<double>(1, 2);
+	projection_matrix.at<float>(2, 0) = 1.0f - 2 * c_x / width;
+	projection_matrix.at<float>(2, 1) = 2 * c_y / height - 1.0f;
+	projection_matrix.at<float>(2, 2) = -(farp + nearp) / (farp - nearp);
+	projection_matrix.at<float>(2, 3) = -1.0f;
 
-	projection_matrix_.at<float>(0, 0) = 2 * f_x / (float)fwidth_;
-	projection_matrix_.at<float>(1, 1) = 2 * f_y / (float)fheight_;
+	projection_matrix.at<float>(3, 2) = -2.0f*farp*nearp / (farp - nearp);
+}
+
+// Background lookup table: for every texel of the displayed (undistorted) image the texture
+// coordinate of the distorted camera pixel to sample. Both the table and the camera texture keep the
+// image's row order (row 0 at v = 0), the background flips through its texture coordinates. The new
+// camera matrix equals the old one, which keeps the table consistent with setProjection.
+void Camera::setUndistortMap(Intrinsics &intrinsics)
+{
+	int width = intrinsics.size.width, height = intrinsics.size.height;
+	Mat map, unused;
+	initUndistortRectifyMap(intrinsics.camera_matrix, intrinsics.dist_coeffs, Mat(), intrinsics.camera_matrix, intrinsics.size, CV_32FC2, map, unused);
+
+	intrinsics.undistort_map.create(height, width, CV_32FC2);
+	for (int row = 0; row < height; row++)
+	{
+		const Vec2f *src = map.ptr<Vec2f>(row);
+		Vec2f *dst = intrinsics.undistort_map.ptr<Vec2f>(row);
+		for (int col = 0; col < width; col++)
+		{
+			dst[col][0] = (src[col][0] + 0.5f) / width;
+			dst[col][1] = (src[col][1] + 0.5f) / height;
+		}
+	}
+}
 
-	projection_matrix_.at<float>(2, 0) = 1.0f - 2 * c_x / (float)fwidth_;
-	projection_matrix_.at<float>(2, 1) = 2 * c_y / (float)fheight_ - 1.0f;
-	projection_matrix_.at<float>(2, 2) = -(farp + nearp) / (farp - nearp);
-	projection_matrix_.at<float>(2, 3) = -1.0f;
+// Calibration scaled to another resolution of the same sensor. Pixel centers are kept aligned,
+// hence the half pixel terms on the principal point. Distortion acts on normalized image
+// coordinates, so the coefficients carry over unchanged.
+Intrinsics &Camera::get_intrinsics(Size size)
+{
+	auto key = make_pair(size.width, size.height);
+	auto it = intrinsics_.find(key);
+	if (it != intrinsics_.end())
+		return it->second;
 
-	projection_matrix_.at<float>(3, 2) = -2.0f*farp*nearp / (farp - nearp);
+	Intrinsics &intrinsics = intrinsics_[key];
+	double sx = (double)size.width / fwidth_;
+	double sy = (double)size.height / fheight_;
+	intrinsics.size = size;
+	intrinsics.camera_matrix = camera_matrix_.clone();
+	intrinsics.camera_matrix.at<double>(0, 0) *= sx;
+	intrinsics.camera_matrix.at<double>(1, 1) *= sy;
+	intrinsics.camera_matrix.at<double>(0, 2) = (camera_matrix_.at<double>(0, 2) + 0.5) * sx - 0.5;
+	intrinsics.camera_matrix.at<double>(1, 2) = (camera_matrix_.at<double>(1, 2) + 0.5) * sy - 0.5;
+	intrinsics.dist_coeffs = dist_coeffs_.clone();
+	setProjection(intrinsics);
+	setUndistortMap(intrinsics);
+	return intrinsics;
 }
 
-Camera::Camera(shared_ptr<Config> config_ptr)
+Camera::Camera(shared_ptr<Config> config_ptr) : pose_solver_(MarkerLength)
 {
 	config_ptr->get("image_width", fwidth_);
 	config_ptr->get("image_height", fheight_);
 	config_ptr->get("camera_matrix", camera_matrix_);
 	config_ptr->get("distortion_coefficients", dist_coeffs_);
 
+	int filter_mode = 0;
+	config_ptr->get("pose_filter", filter_mode);
+	filter_mode_ = (PoseFilter::Mode)filter_mode;
+	anchor_id_ = -1;
+	display_time_ = 0;
+
 	dictionary_ = getPredefinedDictionary(aruco::PREDEFINED_DICTIONARY_NAME(0));
 
-	setProjection();
+	active_ = &get_intrinsics(Size(fwidth_, fheight_));
+	display_ = active_.load();
 }
 
 Camera::~Camera()
 {
 }
 
-bool Camera::marker_based_compute(Mat &image)
+// builds the intrinsics of every size up front so that later switches cost nothing
+void Camera::prepare_working_sizes(const vector<Size> &sizes)
+{
+	for (const Size &size : sizes)
+		get_intrinsics(size);
+}
+
+// detection thread: frames passed to marker_based_compute from now on have this size
+void Camera::set_working_size(Size size)
+{
+	if (active_.load()->size != size)
+		active_ = &get_intrinsics(size);
+}
+
+// the display frame (background, projection) may have another resolution than the detection frame
+void Camera::set_display_size(Size size)
+{
+	display_ = &get_intrinsics(size);
+}
+
+bool Camera::marker_based_compute(Mat &image, double time)
+{
+	return marker_based_compute(image, image, time);
+}
+
+// detects on frame at the working size; the markers are drawn into display, which is the same
+// image seen at any other resolution
+bool Camera::marker_based_compute(Mat &image, Mat &display, double time)
 {
 	Ptr<DetectorParameters> detectorParams = DetectorParameters::create();
 
@@ -50,44 +150,51 @@ bool Camera::marker_based_compute(Mat &image)
 	cv::aruco::detectMarkers(image, dictionary_, markerCorners, markerIds, detectorParams, rejectedCandidates);
 
 	if (markerIds.size() > 0) {
-		std::vector< cv::Vec3d > rvecs, tvecs;
-
-		cv::aruco::drawDetectedMarkers(image, markerCorners, markerIds);
-		cv::aruco::estimatePoseSingleMarkers(markerCorners, MarkerLength, camera_matrix_, dist_coeffs_, rvecs, tvecs);
+		if (display.size() == image.size())
+			cv::aruco::drawDetectedMarkers(display, markerCorners, markerIds);
+		else
+		{
+			map_corners(markerCorners, image.size(), display.size(), display_corners_);
+			cv::aruco::drawDetectedMarkers(display, display_corners_, markerIds);
+		}
+		const Intrinsics &intrinsics = *active_.load();
+		pose_solver_.Solve(markerCorners, intrinsics.camera_matrix, intrinsics.dist_coeffs, poses_);
 
 		for (unsigned int i = 0; i < markerIds.size(); i++) {
-			cv::Mat rot;
-			cv::Vec3d r = rvecs[i];
-			cv::Vec3d t = tvecs[i];
+			const cv::Matx33d &rot = poses_[i].rotation[0];
+			const cv::Vec3d &t = poses_[i].translation[0];
 
-			view_matrix_ = cv::Mat::zeros(4, 4, CV_32F);
-
-			Rodrigues(rvecs[i], rot);
+			glm::mat3 rotation;
 			for (unsigned int row = 0; row < 3; ++row)
 			{
 				for (unsigned int col = 0; col < 3; ++col)
 				{
-					view_matrix_.at<float>(row, col) = (float)rot.at<double>(row, col);
+					rotation[col][row] = (float)rot(row, col);
 				}
-				view_matrix_.at<float>(row, 3) = (float)tvecs[i][row];
 			}
-			view_matrix_.at<float>(3, 3) = 1.0f;
-
-			//cv to gl
-			cv::Mat cvToGl = cv::Mat::zeros(4, 4, CV_32F);
-			cvToGl.at<float>(0, 0) = 1.0f;
-			cvToGl.at<float>(1, 1) = -1.0f;
-			cvToGl.at<float>(2, 2) = -1.0f;
-			cvToGl.at<float>(3, 3) = 1.0f;
-			view_matrix_ = cvToGl * view_matrix_;
-			cv::transpose(view_matrix_, view_matrix_);
+
+			auto it = pose_filters_.find(markerIds[i]);
+			if (it == pose_filters_.end())
+				it = pose_filters_.insert(make_pair(markerIds[i], PoseFilter(filter_mode_))).first;
+			it->second.Update(rotation, vec3(t[0], t[1], t[2]), time);
+			anchor_id_ = markerIds[i];
 		}
+		pose_mailbox_.Publish(pose_filters_[anchor_id_].state());
 		return true;
 	}
 
+	PoseState lost;
+	lost.time = time;
+	pose_mailbox_.Publish(lost);
 	return false;
 }
 
+// the table is in texture coordinates, so it only depends on the working size through pixel centers
+const Mat &Camera::get_undistort_map()
+{
+	return display_.load()->undistort_map;
+}
+
 int Camera::getWidth()
 {
 	return fwidth_;
@@ -98,22 +205,59 @@ int Camera::getHeight()
 	return fheight_;
 }
 
+void Camera::set_display_time(double time)
+{
+	display_time_ = time;
+}
+
 mat4 Camera::get_view_matrix()
 {
-	glm::mat4 temp;
-	for (int i = 0; i < 4; i++)
-		for (int j = 0; j < 4; j++)
-			temp[i][j] = view_matrix_.at<float>(i, j);
+	return get_view_matrix(display_time_);
+}
 
-	return temp;
+// render thread: take the newest pose published by the detector
+bool Camera::latch_pose()
+{
+	if (!pose_mailbox_.Read(latched_pose_))
+		latched_pose_ = PoseState();
+	return latched_pose_.valid;
+}
+
+double Camera::get_pose_time()
+{
+	return latched_pose_.time;
+}
+
+// latches the pose itself, so calling this right before the draw uses the newest detection
+mat4 Camera::get_view_matrix(double display_time)
+{
+	if (!latch_pose())
+		return mat4(1);
+
+	mat4 view = latched_pose_.predict(display_time);
+	//cv to gl
+	for (int col = 0; col < 4; col++)
+	{
+		view[col][1] = -view[col][1];
+		view[col][2] = -view[col][2];
+	}
+	last_view_matrix_ = view;
+	return view;
+}
+
+// the view matrix handed out by the last get_view_matrix call
+mat4 Camera::get_last_view_matrix()
+{
+	return last_view_matrix_;
 }
 
 mat4 Camera::get_projection_matrix()
 {
+	const Mat &projection_matrix = display_.load()->projection_matrix;
 	glm::mat4 temp;
 	for (int i = 0; i < 4; i++)
 		for (int j = 0; j < 4; j++)
-			temp[i][j] = projection_matrix_.at<float>(i, j);
+			temp[i][j] = projection_matrix.at<float>(i, j);
 
 	return temp;
 }
@@ -0,0 +1,33 @@
+#include <iostream>
+#include <algorithm>
+
+#include "frame_stats.h"
+
+FrameStats::FrameStats(double interval) : interval_(interval), last_report_(-1), frames_(0) {
+}
+
+void FrameStats::Add(const std::string &name, double value) {
+	auto it = entries_.find(name);
+	if (it == entries_.end()) it = entries_.insert(std::make_pair(name, Entry{ 0, value, 0 })).first;
+	it->second.sum += value;
+	it->second.max = std::max(it->second.max, value);
+	it->second.samples++;
+}
+
+// call once per frame; prints avg/max of every entry and the frame rate when the interval has elapsed
+void FrameStats::Report(double time) {
+	frames_++;
+	if (last_report_ < 0) last_report_ = time;
+	if (time - last_report_ < interval_) return;
+
+	std::cout << "[stats] " << frames_ / (time - last_report_) << " fps";
+	for (const auto &entry : entries_) {
+		if (entry.second.samples == 0) continue;
+		std::cout << " | " << entry.first << " avg " << entry.second.sum / entry.second.samples << " max " << entry.second.max;
+	}
+	std::cout << std::endl;
+
+	for (auto &entry : entries_) entry.second = Entry{ 0, 0, 0 };
+	last_report_ = time;
+	frames_ = 0;
+}
@@ -4,10 +4,19 @@
 #include <opencv2/opencv.hpp>
 
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
 
 #include "background.h"
+#include "background_uploader.h"
 #include "camera.h"
 #include "config.h"
+#include "frame_stats.h"
+#include "model_layer.h"
+#include "resolution_controller.h"
 #include "sprite.h"
 
 using namespace cv;
@@ -19,6 +28,11 @@ std::shared_ptr<SpriteModel> sprite_model_ptr;
 
 GLFWwindow *window;
 
+// after this many warped frames in a row the model is re-rendered even if it overruns
+const int kMaxReprojectedFrames = 2;
+// detection resolutions relative to the calibration, tried largest first
+const double kResolutionScales[] = { 1.0, 0.75, 0.5 };
+
 void processInput(GLFWwindow *window)
 {
 	if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
@@ -64,38 +78,253 @@ void Init()
 int main()
 {
 	Init();
-	sprite_model_ptr = make_shared<SpriteModel>(".\\models\\sprite\\sprite.fbx");
-	bool has_marker = false;
+	// bones per draw, 0 to upload the whole skeleton once for all meshes
+	int bone_batch_size = 0;
+	config_ptr->get("bone_batch_size", bone_batch_size);
+	sprite_model_ptr = make_shared<SpriteModel>(".\\models\\sprite\\sprite.fbx", bone_batch_size);
+	// updates to time the skeleton with, on the model and on a generated 500 bone rig
+	int skeleton_benchmark = 0;
+	config_ptr->get("skeleton_benchmark", skeleton_benchmark);
+	if (skeleton_benchmark > 0)
+	{
+		sprite_model_ptr->Benchmark(skeleton_benchmark);
+		Skeleton::Benchmark(500, skeleton_benchmark);
+		Skeleton::BenchmarkSampling(skeleton_benchmark * 100);
+	}
 	VideoCapture cap(1);
-	shared_ptr<Background> background_ptr = make_shared<Background>();
+	// raw NV12 / YUYV skip the driver's conversion to BGR; the luma plane goes to detection as is
+	string capture_format = "BGR";
+	config_ptr->get("capture_format", capture_format);
+	Background::Format frame_format = Background::ParseFormat(capture_format);
+	if (frame_format != Background::BGR)
+	{
+		cap.set(CAP_PROP_FOURCC, frame_format == Background::NV12 ? VideoWriter::fourcc('N', 'V', '1', '2') : VideoWriter::fourcc('Y', 'U', 'Y', 'V'));
+		cap.set(CAP_PROP_CONVERT_RGB, 0);
+	}
+	// the background is shown at the capture resolution, detection runs on a scaled copy
+	Size display_size((int)cap.get(CAP_PROP_FRAME_WIDTH), (int)cap.get(CAP_PROP_FRAME_HEIGHT));
+	if (display_size.area() > 0)
+		camera_ptr->set_display_size(display_size);
+	if (frame_format != Background::BGR)
+	{
+		Mat probe, luma, chroma;
+		cap >> probe;
+		if (!Background::Planes(probe, frame_format, display_size, luma, chroma))
+		{
+			cout << "capture does not deliver raw " << capture_format << ", using BGR" << endl;
+			cap.set(CAP_PROP_CONVERT_RGB, 1);
+			frame_format = Background::BGR;
+		}
+	}
+	// 0: glTexSubImage2D from client memory, 1: through a ring of pixel buffers, 2: persistently mapped
+	// ring if the context has buffer storage, otherwise the next best
+	int background_upload = 0, upload_buffers = 3, upload_benchmark = 0;
+	config_ptr->get("background_upload", background_upload);
+	config_ptr->get("upload_buffers", upload_buffers);
+	config_ptr->get("upload_benchmark", upload_benchmark);
+	if (upload_benchmark)
+	{
+		Size size = display_size.area() > 0 ? display_size : Size(camera_ptr->getWidth(), camera_ptr->getHeight());
+		StreamingTexture::Benchmark(size, 300, upload_buffers);
+		Background::Benchmark(size, 300);
+	}
+	shared_ptr<Background> background_ptr = make_shared<Background>((StreamingTexture::Upload)background_upload, upload_buffers);
+	background_ptr->SetFormat(frame_format, display_size);
+	cout << "background upload: " << StreamingTexture::Name(background_ptr->texture().upload()) << endl;
+	int undistort_background = 0;
+	config_ptr->get("undistort_background", undistort_background);
+	if (undistort_background)
+		background_ptr->SetUndistortMap(camera_ptr->get_undistort_map());
+	// upload on a thread with its own shared context, the render thread only binds
+	int background_uploader = 0;
+	config_ptr->get("background_uploader", background_uploader);
+	shared_ptr<BackgroundUploader> uploader_ptr;
+	if (background_uploader)
+	{
+		uploader_ptr = make_shared<BackgroundUploader>(window, frame_format, display_size, (StreamingTexture::Upload)background_upload, upload_buffers);
+		if (!uploader_ptr->valid())
+			uploader_ptr.reset();
+	}
+	shared_ptr<ModelLayer> model_layer_ptr = make_shared<ModelLayer>();
+	FrameStats stats;
 	int length = 8;
+
+	// a frame is due every camera frame; assume 30 fps if the driver does not say
+	double camera_fps = cap.get(CAP_PROP_FPS);
+	double frame_budget = camera_fps > 0 ? 1.0 / camera_fps : 1.0 / 30.0;
+	// CPU time to issue the model layer; its GPU time comes from the layer's timer queries
+	double model_cpu_cost = 0;
+	int reprojected_in_row = 0, reprojected_frames = 0, frames = 0;
+	int uniform_lookups = Shader::total_string_lookups();
+
+	// detection has to finish within a camera frame, the controller trades resolution for time
+	int dynamic_resolution = 0, detection_width = 0, detection_height = 0;
+	config_ptr->get("dynamic_resolution", dynamic_resolution);
+	config_ptr->get("detection_width", detection_width);
+	config_ptr->get("detection_height", detection_height);
+	if (detection_width <= 0 || detection_height <= 0)
+	{
+		detection_width = camera_ptr->getWidth();
+		detection_height = camera_ptr->getHeight();
+	}
+	vector<Size> working_sizes;
+	for (double scale : kResolutionScales)
+	{
+		working_sizes.push_back(Size(int(detection_width * scale) & ~1, int(detection_height * scale) & ~1));
+		if (!dynamic_resolution)
+			break;
+	}
+	camera_ptr->prepare_working_sizes(working_sizes);
+	ResolutionController resolution_controller(working_sizes, frame_budget * 0.8);
+
+	// capture + detection run on their own thread; poses reach the renderer through the camera's mailbox
+	mutex frame_mutex;
+	Mat latest_frame, frame;
+	bool frame_ready = false;
+	atomic<bool> running(true);
+	thread detector([&]() {
+		Mat captured, resized, luma, chroma;
+		while (running)
+		{
+			cap >> captured;
+			if (captured.empty())
+				continue;
+			double detect_start = glfwGetTime();
+			// markers are drawn into what is detected on: the frame, or the luma plane of a raw frame
+			Mat &image = frame_format == Background::BGR ? captured : luma;
+			if (frame_format != Background::BGR && !Background::Planes(captured, frame_format, display_size, luma, chroma))
+				continue;
+			Size working_size = resolution_controller.size();
+			camera_ptr->set_working_size(working_size);
+			if (image.size() != working_size)
+			{
+				resize(image, resized, working_size, 0, 0, INTER_AREA);
+				camera_ptr->marker_based_compute(resized, image, detect_start);
+			}
+			else
+				camera_ptr->marker_based_compute(image, detect_start);
+			if (resolution_controller.Update(glfwGetTime() - detect_start))
+				cout << "detection resolution " << resolution_controller.size() << endl;
+
+			if (uploader_ptr)
+			{
+				uploader_ptr->Submit(captured);
+				continue;
+			}
+			lock_guard<mutex> lock(frame_mutex);
+			std::swap(latest_frame, captured);
+			frame_ready = true;
+		}
+	});
+
 	while (!glfwWindowShouldClose(window))
 	{
 		static double last_time = glfwGetTime();
 		double current_time = glfwGetTime();
+		double frame_time = current_time - last_time;
 		last_time = current_time;
 
-		Mat frame;
 		processInput(window);
 		/**********************************************************************/
-		cap >> frame;
-		has_marker = camera_ptr->marker_based_compute(frame);
-		cv::flip(frame, frame, 0);
-		background_ptr->Draw(frame);
+		bool new_frame = false;
+		if (uploader_ptr)
+		{
+			double acquire_start = glfwGetTime(), upload_ms;
+			unsigned int texture, chroma;
+			bool shown = uploader_ptr->Acquire(texture, chroma, upload_ms);
+			stats.Add("acquire_ms", (glfwGetTime() - acquire_start) * 1000.0);
+			if (upload_ms >= 0)
+				stats.Add("upload_ms", upload_ms);
+			if (shown)
+				background_ptr->Draw(texture, chroma);
+		}
+		else
+		{
+			lock_guard<mutex> lock(frame_mutex);
+			if (frame_ready)
+			{
+				std::swap(latest_frame, frame);
+				frame_ready = false;
+				new_frame = true;
+			}
+		}
+		// upload only when the camera delivered, the render loop may run faster than capture
+		if (new_frame && !frame.empty())
+		{
+			double upload_start = glfwGetTime();
+			background_ptr->Update(frame);
+			stats.Add("upload_ms", (glfwGetTime() - upload_start) * 1000.0);
+			stats.Add("upload_kb", frame.total() * frame.elemSize() / 1024.0);
+		}
+		if (!uploader_ptr && !frame.empty())
+			background_ptr->Draw();
 
 		/*******************************ģ***************************************/
 		glClear(GL_DEPTH_BUFFER_BIT);
 
-		current_time = current_time - int(current_time) / length * length;
+		// the frame is shown after this iteration's swap, roughly one frame from now
+		camera_ptr->set_display_time(current_time + frame_time);
+		double animation_time = current_time - int(current_time) / length * length;
+
+		if (camera_ptr->latch_pose())
+		{
+			// re-render the model layer only if it is done before the next camera frame is due, otherwise
+			// warp the last one; a pose older than a frame is due at the next multiple of the frame period
+			double deadline = camera_ptr->get_pose_time() + frame_budget;
+			double now = glfwGetTime();
+			if (deadline < now)
+				deadline += std::ceil((now - deadline) / frame_budget) * frame_budget;
+			double model_gpu_cost = model_layer_ptr->gpu_time();
+			stats.Add("model_gpu_ms", model_gpu_cost * 1000.0);
+			bool late = now + std::max(model_cpu_cost, model_gpu_cost) > deadline;
+			if (late && model_layer_ptr->valid() && reprojected_in_row < kMaxReprojectedFrames)
+			{
+				reprojected_in_row++;
+				reprojected_frames++;
+			}
+			else
+			{
+				double model_start = glfwGetTime();
+				int width, height;
+				glfwGetFramebufferSize(window, &width, &height);
+				model_layer_ptr->Begin(width, height);
+				// the view matrix is latched inside Draw, after the bone update and right before the meshes are drawn
+				sprite_model_ptr->Draw(0, camera_ptr, animation_time);
+				stats.Add("bone_upload_kb", sprite_model_ptr->bone_upload_bytes() / 1024.0);
+				stats.Add("model_draws", sprite_model_ptr->draw_count());
+				stats.Add("bone_update_ms", sprite_model_ptr->bone_update_ms());
+				model_layer_ptr->End(camera_ptr->get_last_view_matrix());
+				model_cpu_cost = 0.9 * model_cpu_cost + 0.1 * (glfwGetTime() - model_start);
+				reprojected_in_row = 0;
+			}
+			stats.Add("reprojected", reprojected_in_row > 0 ? 1 : 0);
 
-		if (has_marker)
-			sprite_model_ptr->Draw(0, camera_ptr, current_time);
-		
+			// composite with the newest pose; the warp is the identity if nothing newer arrived
+			model_layer_ptr->Composite(camera_ptr->get_view_matrix(), camera_ptr->get_projection_matrix());
+			stats.Add("pose_age_ms", (glfwGetTime() - camera_ptr->get_pose_time()) * 1000.0);
+		}
+		frames++;
+		// uniforms still set by name in the frame, should stay at 0
+		stats.Add("uniform_lookups", Shader::total_string_lookups() - uniform_lookups);
+		uniform_lookups = Shader::total_string_lookups();
 
 		glfwSwapBuffers(window);
 		glfwPollEvents();
+		stats.Report(glfwGetTime());
 	}
 
+	running = false;
+	detector.join();
+	cout << "reprojected " << reprojected_frames << " of " << frames << " frames" << endl;
+	cout << "uniforms set by name " << Shader::total_string_lookups() << " times" << endl;
+	if (uploader_ptr)
+	{
+		cout << "uploader dropped " << uploader_ptr->dropped() << " frames" << endl;
+		uploader_ptr.reset();
+	}
+	else
+		cout << "background texture allocated " << background_ptr->texture().allocations() << " times, "
+			<< background_ptr->texture().busy_buffers() << " upload buffers found busy" << endl;
 	glfwTerminate();
 	return 0;
 }
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <map>
 
 #include <glad/glad.h>
 #include <glm/gtc/matrix_transform.hpp>
@@ -9,7 +10,8 @@
 using namespace glm;
 using namespace boost;
 
-Mesh::Mesh(filesystem::path directory_path, aiMesh *mesh, const aiScene *scene, Namer &bone_namer, std::vector<glm::mat4> &bone_offsets) {
+Mesh::Mesh(filesystem::path directory_path, aiMesh *mesh, const aiScene *scene, Namer &bone_namer, std::vector<glm::mat4> &bone_offsets, int max_batch_bones)
+	: partitioned_(max_batch_bones > 0) {
 	auto mat4_from_aimatrix4x4 = [](aiMatrix4x4 matrix) -> mat4 {
 		mat4 res;
 		for (int i = 0; i < 4; i++) for (int j = 0; j < 4; j++) res[j][i] = matrix[i][j];
@@ -45,7 +47,6 @@ Mesh::Mesh(filesystem::path directory_path, aiMesh *mesh, const aiScene *scene,
 		auto face = mesh->mFaces[i];
 		for (int j = 0; j < face.mNumIndices; j++) indices.push_back(face.mIndices[j]);
 	}
-	indices_size_ = (uint32_t)indices.size();
 
 	for (int i = 0; i < mesh->mNumBones; i++) {
 		auto bone = mesh->mBones[i];
@@ -60,6 +61,14 @@ Mesh::Mesh(filesystem::path directory_path, aiMesh *mesh, const aiScene *scene,
 		}
 	}
 
+	if (partitioned_) {
+		Partition(vertices, indices, max_batch_bones);
+	} else {
+		batches_.resize(1);
+		batches_[0].first_index = 0;
+		batches_[0].index_count = (uint32_t)indices.size();
+	}
+
 	glGenVertexArrays(1, &vao_);
 	glGenBuffers(1, &vbo_);
 	glGenBuffers(1, &ebo_);
@@ -101,12 +110,83 @@ Mesh::~Mesh() {
 	glDeleteTextures(1, &texture_id_);
 }
 
-void Mesh::Draw(std::weak_ptr<Shader> shader_ptr) const {
+// greedy over the triangles in order: a triangle goes into the current batch unless its bones would
+// push the batch over the limit, then the batch is closed. Vertices shared across a batch boundary
+// are duplicated, each copy with the ids of its own batch.
+void Mesh::Partition(std::vector<Vertex> &vertices, std::vector<uint32_t> &indices, int max_batch_bones) {
+	// a single triangle may reference up to three vertices' worth of bones
+	max_batch_bones = std::max(max_batch_bones, 3 * kMaxBonesPerVertex);
+
+	std::vector<Vertex> batch_vertices;
+	std::vector<uint32_t> batch_indices;
+	std::map<int, int> local_bones;
+	std::vector<int> remap(vertices.size(), -1), touched;
+	Batch batch;
+	batch.first_index = 0;
+
+	auto close_batch = [&]() {
+		batch.index_count = (uint32_t)batch_indices.size() - batch.first_index;
+		if (batch.index_count > 0) batches_.push_back(batch);
+		batch.first_index = (uint32_t)batch_indices.size();
+		batch.bones.clear();
+		local_bones.clear();
+		for (int v : touched) remap[v] = -1;
+		touched.clear();
+	};
+
+	for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+		int missing = 0;
+		std::vector<int> triangle_bones;
+		for (int k = 0; k < 3; k++) {
+			const Vertex &vertex = vertices[indices[t + k]];
+			for (int i = 0; i < kMaxBonesPerVertex; i++) {
+				int bone = vertex.bone_ids[i];
+				if (vertex.bone_weights[i] == 0 || std::find(triangle_bones.begin(), triangle_bones.end(), bone) != triangle_bones.end()) continue;
+				triangle_bones.push_back(bone);
+				if (!local_bones.count(bone)) missing++;
+			}
+		}
+		if (batch.bones.size() + missing > (size_t)max_batch_bones) close_batch();
+		for (int bone : triangle_bones) {
+			if (local_bones.count(bone)) continue;
+			local_bones[bone] = (int)batch.bones.size();
+			batch.bones.push_back(bone);
+		}
+
+		for (int k = 0; k < 3; k++) {
+			uint32_t v = indices[t + k];
+			if (remap[v] < 0) {
+				Vertex vertex = vertices[v];
+				for (int i = 0; i < kMaxBonesPerVertex; i++) {
+					vertex.bone_ids[i] = vertex.bone_weights[i] == 0 ? 0 : local_bones[vertex.bone_ids[i]];
+				}
+				remap[v] = (int)batch_vertices.size();
+				touched.push_back(v);
+				batch_vertices.push_back(vertex);
+			}
+			batch_indices.push_back((uint32_t)remap[v]);
+		}
+	}
+	close_batch();
+
+	vertices.swap(batch_vertices);
+	indices.swap(batch_indices);
+}
+
+void Mesh::Bind() const {
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, texture_id_);
-	shader_ptr.lock()->SetUniform<int32_t>("uDiffuseTexture", 0);
-
 	glBindVertexArray(vao_);
-	glDrawArrays(GL_TRIANGLES, 0, indices_size_);
-	glBindVertexArray(0);
+}
+
+void Mesh::Draw(size_t batch) const {
+	glDrawElements(GL_TRIANGLES, batches_[batch].index_count, GL_UNSIGNED_INT, (void *)(batches_[batch].first_index * sizeof(uint32_t)));
+}
+
+const std::vector<Mesh::Batch> &Mesh::batches() const {
+	return batches_;
+}
+
+bool Mesh::partitioned() const {
+	return partitioned_;
 }
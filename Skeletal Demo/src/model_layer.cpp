@@ -0,0 +1,153 @@
+#include "model_layer.h"
+
+using namespace glm;
+
+ModelLayer::ModelLayer()
+	: fbo_(0), color_texture_(0), depth_buffer_(0), width_(0), height_(0), valid_(false), layer_view_(1), next_query_(0), timing_(false), gpu_time_(0) {
+	// full-screen triangle from gl_VertexID; every pixel is traced back onto a plane through the
+	// marker origin that faces the camera the layer was rendered with, then looked up in that layer
+	std::string vs_source =
+		"#version 330 core\n"
+		"out vec2 vNdc;\n"
+		"void main()\n"
+		"{\n"
+		"	vNdc = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2.0 - 1.0;\n"
+		"	gl_Position = vec4(vNdc, 0.0, 1.0);\n"
+		"}\n";
+	std::string fs_source =
+		"#version 330 core\n"
+		"in vec2 vNdc;\n"
+		"out vec4 fragColor;\n"
+		"uniform sampler2D uLayer;\n"
+		"uniform mat4 uInverseViewProjection;\n"
+		"uniform mat4 uLayerViewProjection;\n"
+		"uniform vec3 uPlaneNormal;\n"
+		"void main()\n"
+		"{\n"
+		"	vec4 near = uInverseViewProjection * vec4(vNdc, -1.0, 1.0);\n"
+		"	vec4 far = uInverseViewProjection * vec4(vNdc, 1.0, 1.0);\n"
+		"	vec3 a = near.xyz / near.w;\n"
+		"	vec3 b = far.xyz / far.w;\n"
+		"	float t = dot(-a, uPlaneNormal) / dot(b - a, uPlaneNormal);\n"
+		"	vec4 clip = uLayerViewProjection * vec4(a + t * (b - a), 1.0);\n"
+		"	vec2 uv = clip.xy / clip.w * 0.5 + 0.5;\n"
+		"	if (clip.w <= 0.0 || any(lessThan(uv, vec2(0.0))) || any(greaterThan(uv, vec2(1.0))))\n"
+		"		discard;\n"
+		"	fragColor = texture(uLayer, uv);\n"
+		"}\n";
+	shader_ptr_ = std::make_shared<Shader>(vs_source, fs_source);
+	inverse_view_projection_uniform_ = shader_ptr_->Uniform("uInverseViewProjection");
+	layer_view_projection_uniform_ = shader_ptr_->Uniform("uLayerViewProjection");
+	plane_normal_uniform_ = shader_ptr_->Uniform("uPlaneNormal");
+	layer_uniform_ = shader_ptr_->Uniform("uLayer");
+
+	glGenFramebuffers(1, &fbo_);
+	glGenTextures(1, &color_texture_);
+	glGenRenderbuffers(1, &depth_buffer_);
+	glGenVertexArrays(1, &vao_);
+	glGenQueries(kTimerQueries, queries_);
+	for (int i = 0; i < kTimerQueries; i++) query_pending_[i] = false;
+}
+
+ModelLayer::~ModelLayer() {
+	glDeleteFramebuffers(1, &fbo_);
+	glDeleteTextures(1, &color_texture_);
+	glDeleteRenderbuffers(1, &depth_buffer_);
+	glDeleteVertexArrays(1, &vao_);
+	glDeleteQueries(kTimerQueries, queries_);
+}
+
+void ModelLayer::Resize(int width, int height) {
+	width_ = width;
+	height_ = height;
+
+	glBindTexture(GL_TEXTURE_2D, color_texture_);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glBindRenderbuffer(GL_RENDERBUFFER, depth_buffer_);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color_texture_, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_buffer_);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	valid_ = false;
+}
+
+void ModelLayer::Begin(int width, int height) {
+	if (width != width_ || height != height_) Resize(width, height);
+	glGetIntegerv(GL_VIEWPORT, viewport_);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+	glViewport(0, 0, width_, height_);
+	glClearColor(0, 0, 0, 0);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	// a query still in flight after a whole ring of frames is not waited for, this layer goes untimed
+	PollQueries();
+	timing_ = !query_pending_[next_query_];
+	if (timing_) glBeginQuery(GL_TIME_ELAPSED, queries_[next_query_]);
+}
+
+void ModelLayer::End(const mat4 &view_matrix) {
+	if (timing_) {
+		glEndQuery(GL_TIME_ELAPSED);
+		query_pending_[next_query_] = true;
+		next_query_ = (next_query_ + 1) % kTimerQueries;
+		timing_ = false;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(viewport_[0], viewport_[1], viewport_[2], viewport_[3]);
+	layer_view_ = view_matrix;
+	valid_ = true;
+}
+
+bool ModelLayer::valid() const {
+	return valid_;
+}
+
+void ModelLayer::PollQueries() {
+	// oldest first, so the average takes the results in order
+	for (int i = 0; i < kTimerQueries; i++) {
+		int query = (next_query_ + i) % kTimerQueries;
+		if (!query_pending_[query]) continue;
+		GLint available = 0;
+		glGetQueryObjectiv(queries_[query], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) break;
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(queries_[query], GL_QUERY_RESULT, &elapsed);
+		query_pending_[query] = false;
+		double seconds = elapsed * 1e-9;
+		gpu_time_ = gpu_time_ > 0 ? 0.9 * gpu_time_ + 0.1 * seconds : seconds;
+	}
+}
+
+double ModelLayer::gpu_time() {
+	PollQueries();
+	return gpu_time_;
+}
+
+void ModelLayer::Composite(const mat4 &view_matrix, const mat4 &projection_matrix) {
+	if (!valid_) return;
+	// the plane goes through the marker origin, facing the camera the layer was rendered from
+	vec3 layer_camera = vec3(inverse(layer_view_)[3]);
+	vec3 plane_normal = normalize(-layer_camera);
+
+	glDisable(GL_DEPTH_TEST);
+	shader_ptr_->Use();
+	shader_ptr_->SetUniform<mat4>(inverse_view_projection_uniform_, inverse(projection_matrix * view_matrix));
+	shader_ptr_->SetUniform<mat4>(layer_view_projection_uniform_, projection_matrix * layer_view_);
+	shader_ptr_->SetUniform<vec3>(plane_normal_uniform_, plane_normal);
+	shader_ptr_->SetUniform<int32_t>(layer_uniform_, 0);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, color_texture_);
+	glBindVertexArray(vao_);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glBindVertexArray(0);
+	glEnable(GL_DEPTH_TEST);
+}
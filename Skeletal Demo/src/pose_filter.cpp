@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <cmath>
+
+#include <glm/gtc/constants.hpp>
+
+#include "pose_filter.h"
+
+using namespace glm;
+
+namespace {
+
+// smoothing factor of a first order low-pass with the given cutoff frequency
+float Alpha(float cutoff, float dt) {
+	float tau = 1.0f / (2.0f * pi<float>() * cutoff);
+	return 1.0f / (1.0f + tau / dt);
+}
+
+}
+
+PoseState::PoseState() : position(0), velocity(0), rotation(1, 0, 0, 0), angular_velocity(0), time(0), valid(false) {
+}
+
+mat4 PoseState::predict(double t) const {
+	float dt = (float)std::min(std::max(t - time, 0.0), kMaxPrediction);
+	quat q = rotation;
+	float speed = length(angular_velocity);
+	if (speed > 1e-6f) q = angleAxis(speed * dt, angular_velocity / speed) * q;
+	mat4 res = mat4_cast(q);
+	res[3] = vec4(position + velocity * dt, 1);
+	return res;
+}
+
+PoseFilter::PoseFilter(Mode mode) : mode_(mode) {
+	min_cutoff = 1.0f;
+	beta = 0.5f;
+	derivative_cutoff = 1.0f;
+	rotation_min_cutoff = 1.0f;
+	rotation_beta = 0.3f;
+	process_noise = 50.0f;
+	measurement_noise = 1e-3f;
+	Reset();
+}
+
+void PoseFilter::Reset() {
+	state_ = PoseState();
+}
+
+const PoseState &PoseFilter::state() const {
+	return state_;
+}
+
+mat4 PoseFilter::predict(double t) const {
+	return state_.predict(t);
+}
+
+void PoseFilter::Update(const mat3 &rotation, const vec3 &translation, double time) {
+	quat q = normalize(quat_cast(rotation));
+	float dt = (float)(time - state_.time);
+	// first sample, or tracking was lost for a while: restart from the measurement
+	if (!state_.valid || dt > 0.5f) {
+		state_.position = translation;
+		state_.velocity = vec3(0);
+		state_.rotation = q;
+		state_.angular_velocity = vec3(0);
+		state_.time = time;
+		state_.valid = true;
+		for (int axis = 0; axis < 3; axis++) {
+			covariance_[axis][0] = measurement_noise;
+			covariance_[axis][1] = 0;
+			covariance_[axis][2] = process_noise;
+		}
+		return;
+	}
+	if (dt <= 0) return;
+
+	if (mode_ == KALMAN)
+		UpdatePositionKalman(translation, dt);
+	else
+		UpdatePositionOneEuro(translation, dt);
+	UpdateRotation(q, dt);
+	state_.time = time;
+}
+
+void PoseFilter::UpdatePositionOneEuro(const vec3 &translation, float dt) {
+	vec3 raw_velocity = (translation - state_.position) / dt;
+	state_.velocity = mix(state_.velocity, raw_velocity, Alpha(derivative_cutoff, dt));
+	float cutoff = min_cutoff + beta * length(state_.velocity);
+	state_.position = mix(state_.position, translation, Alpha(cutoff, dt));
+}
+
+void PoseFilter::UpdatePositionKalman(const vec3 &translation, float dt) {
+	for (int axis = 0; axis < 3; axis++) {
+		float *p = covariance_[axis];
+		// predict: x = F x, P = F P F^T + Q (white acceleration noise)
+		float x = state_.position[axis] + state_.velocity[axis] * dt;
+		float v = state_.velocity[axis];
+		float p00 = p[0] + dt * (2 * p[1] + dt * p[2]) + process_noise * dt * dt * dt / 3;
+		float p01 = p[1] + dt * p[2] + process_noise * dt * dt / 2;
+		float p11 = p[2] + process_noise * dt;
+		// correct with the measured position
+		float s = p00 + measurement_noise;
+		float k0 = p00 / s, k1 = p01 / s;
+		float y = translation[axis] - x;
+		state_.position[axis] = x + k0 * y;
+		state_.velocity[axis] = v + k1 * y;
+		p[0] = (1 - k0) * p00;
+		p[1] = (1 - k0) * p01;
+		p[2] = p11 - k1 * p01;
+	}
+}
+
+void PoseFilter::UpdateRotation(const quat &rotation, float dt) {
+	quat q = rotation;
+	if (dot(q, state_.rotation) < 0) q = -q;
+	// angular rate of the raw measurement relative to the filtered orientation
+	quat delta = q * conjugate(state_.rotation);
+	vec3 axis(delta.x, delta.y, delta.z);
+	float s = length(axis);
+	float angle = 2.0f * std::atan2(s, delta.w);
+	vec3 raw_rate = s > 1e-6f ? axis * (angle / (s * dt)) : axis * (2.0f / dt);
+
+	state_.angular_velocity = mix(state_.angular_velocity, raw_rate, Alpha(derivative_cutoff, dt));
+	float cutoff = rotation_min_cutoff + rotation_beta * length(state_.angular_velocity);
+	state_.rotation = normalize(slerp(state_.rotation, q, Alpha(cutoff, dt)));
+}
@@ -0,0 +1,28 @@
+#include "resolution_controller.h"
+
+ResolutionController::ResolutionController(const std::vector<cv::Size> &levels, double budget)
+	: step_down(1.0f), step_up(0.6f), hold_frames(30), levels_(levels), budget_(budget), average_(0), level_(0), frames_since_switch_(0) {
+}
+
+bool ResolutionController::Update(double cost) {
+	// restart the average at every switch, the old level's cost says little about the new one
+	average_ = frames_since_switch_ == 0 ? cost : 0.9 * average_ + 0.1 * cost;
+	if (++frames_since_switch_ < hold_frames) return false;
+
+	int level = level_;
+	if (average_ > budget_ * step_down && level_ + 1 < (int)levels_.size()) level++;
+	else if (average_ < budget_ * step_up && level_ > 0) level--;
+	if (level == level_) return false;
+
+	level_ = level;
+	frames_since_switch_ = 0;
+	return true;
+}
+
+cv::Size ResolutionController::size() const {
+	return levels_[level_];
+}
+
+int ResolutionController::level() const {
+	return level_;
+}
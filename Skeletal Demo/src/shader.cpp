@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iostream>
 #include <vector>
 
@@ -19,12 +20,14 @@ Shader::Shader(boost::filesystem::path vs_path, boost::filesystem::path fs_path)
 	auto vs_id = Compile(GL_VERTEX_SHADER, vs_source, vs_path);
 	auto fs_id = Compile(GL_FRAGMENT_SHADER, fs_source, fs_path);
 	id = Link(vs_id, fs_id);
+	Reflect();
 }
 
 Shader::Shader(std::string vs_source, std::string fs_source) {
 	auto vs_id = Compile(GL_VERTEX_SHADER, vs_source, "");
 	auto fs_id = Compile(GL_FRAGMENT_SHADER, fs_source, "");
 	id = Link(vs_id, fs_id);
+	Reflect();
 }
 
 uint32_t Shader::Compile(uint32_t type, const std::string &source, boost::filesystem::path path) {
@@ -65,41 +68,110 @@ uint32_t Shader::Link(uint32_t vs_id, uint32_t fs_id) {
 	delete[] log;
 }
 
+int Shader::total_string_lookups_ = 0;
+
+void Shader::Reflect() {
+	string_lookups_ = 0;
+	uniforms_.clear();
+	int count = 0, max_length = 0;
+	glGetProgramiv(id, GL_ACTIVE_UNIFORMS, &count);
+	glGetProgramiv(id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+	std::vector<char> name(std::max(max_length, 1));
+	for (int i = 0; i < count; i++) {
+		ActiveUniform uniform;
+		GLsizei length = 0;
+		GLint size = 0;
+		GLenum type = 0;
+		glGetActiveUniform(id, i, (GLsizei)name.size(), &length, &size, &type, name.data());
+		uniform.name.assign(name.data(), length);
+		// arrays of basic types are reported as "name[0]", callers set them by the plain name; members
+		// of struct arrays ("lights[0].color") are reported per element and keep their full name
+		static const std::string kArraySuffix = "[0]";
+		if (uniform.name.size() > kArraySuffix.size() && uniform.name.compare(uniform.name.size() - kArraySuffix.size(), kArraySuffix.size(), kArraySuffix) == 0)
+			uniform.name.erase(uniform.name.size() - kArraySuffix.size());
+		// uniform block members have no location of their own
+		uniform.location = glGetUniformLocation(id, uniform.name.c_str());
+		if (uniform.location < 0) continue;
+		uniform.size = size;
+		uniform.type = type;
+		uniforms_.push_back(uniform);
+	}
+	std::sort(uniforms_.begin(), uniforms_.end(), [](const ActiveUniform &a, const ActiveUniform &b) {
+		return a.name < b.name;
+	});
+}
+
 void Shader::Use() const {
 	glUseProgram(id);
 }
 
+int32_t Shader::Uniform(const std::string &identifier) const {
+	auto it = std::lower_bound(uniforms_.begin(), uniforms_.end(), identifier, [](const ActiveUniform &a, const std::string &b) {
+		return a.name < b;
+	});
+	if (it == uniforms_.end() || it->name != identifier) return -1;
+	return (int32_t)(it - uniforms_.begin());
+}
+
+int32_t Shader::Location(int32_t handle) const {
+	if (handle < 0 || handle >= (int32_t)uniforms_.size()) return -1;
+	return uniforms_[handle].location;
+}
+
+int Shader::string_lookups() const {
+	return string_lookups_;
+}
+
+int Shader::total_string_lookups() {
+	return total_string_lookups_;
+}
+
 template <>
-void Shader::SetUniform<glm::vec3>(const std::string &identifier, const glm::vec3 &value) const {
-	auto location = glGetUniformLocation(id, identifier.c_str());
+void Shader::SetUniform<glm::vec3>(int32_t handle, const glm::vec3 &value) const {
+	auto location = Location(handle);
 	if (location < 0) return;
 	glUniform3fv(location, 1, value_ptr(value));
 }
 
 template <>
-void Shader::SetUniform<glm::mat4>(const std::string &identifier, const glm::mat4 &value) const {
-	auto location = glGetUniformLocation(id, identifier.c_str());
+void Shader::SetUniform<glm::mat4>(int32_t handle, const glm::mat4 &value) const {
+	auto location = Location(handle);
 	if (location < 0) return;
 	glUniformMatrix4fv(location, 1, GL_FALSE, value_ptr(value));
 }
 
 template <>
-void Shader::SetUniform<int32_t>(const std::string &identifier, const int32_t &value) const {
-	auto location = glGetUniformLocation(id, identifier.c_str());
+void Shader::SetUniform<int32_t>(int32_t handle, const int32_t &value) const {
+	auto location = Location(handle);
 	if (location < 0) return ;
 	glUniform1i(location, value);
 }
 
 template <>
-void Shader::SetUniform<float>(const std::string &identifier, const float &value) const {
-	auto location = glGetUniformLocation(id, identifier.c_str());
+void Shader::SetUniform<float>(int32_t handle, const float &value) const {
+	auto location = Location(handle);
 	if (location < 0) return;
 	glUniform1f(location, value);
 }
 
 template <>
-void Shader::SetUniform<std::vector<glm::mat4>>(const std::string &identifier, const std::vector<glm::mat4> &value) const {
-	auto location = glGetUniformLocation(id, identifier.c_str());
-	if (location < 0) return;
-	glUniformMatrix4fv(location, value.size(), GL_FALSE, value_ptr(value[0]));
+void Shader::SetUniform<std::vector<glm::mat4>>(int32_t handle, const std::vector<glm::mat4> &value) const {
+	auto location = Location(handle);
+	if (location < 0 || value.empty()) return;
+	// never past the declared array length
+	GLsizei count = std::min((GLsizei)value.size(), (GLsizei)uniforms_[handle].size);
+	glUniformMatrix4fv(location, count, GL_FALSE, value_ptr(value[0]));
 }
+
+template <typename T>
+void Shader::SetUniform(const std::string &identifier, const T &value) const {
+	string_lookups_++;
+	total_string_lookups_++;
+	SetUniform<T>(Uniform(identifier), value);
+}
+
+template void Shader::SetUniform<glm::vec3>(const std::string &, const glm::vec3 &) const;
+template void Shader::SetUniform<glm::mat4>(const std::string &, const glm::mat4 &) const;
+template void Shader::SetUniform<int32_t>(const std::string &, const int32_t &) const;
+template void Shader::SetUniform<float>(const std::string &, const float &) const;
+template void Shader::SetUniform<std::vector<glm::mat4>>(const std::string &, const std::vector<glm::mat4> &) const;
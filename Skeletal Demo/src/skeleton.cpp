@@ -0,0 +1,278 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "skeleton.h"
+
+using std::string;
+using std::vector;
+using std::pair;
+using namespace glm;
+
+static mat4 mat4_from_aimatrix4x4(const aiMatrix4x4 &matrix) {
+	mat4 res;
+	for (int i = 0; i < 4; i++) for (int j = 0; j < 4; j++) res[j][i] = matrix[i][j];
+	return res;
+}
+
+Skeleton::Skeleton(aiNode *root, aiAnimation **animations, uint32_t animation_count, Namer &bone_namer)
+	: animations_(animations, animations + animation_count), cursor_animation_(0) {
+	// node name to channel, per animation; only needed while flattening
+	vector<std::map<string, int>> channel_maps(animation_count);
+	for (uint32_t i = 0; i < animation_count; i++) {
+		for (uint32_t j = 0; j < animations[i]->mNumChannels; j++) {
+			channel_maps[i][animations[i]->mChannels[j]->mNodeName.C_Str()] = (int)j;
+		}
+	}
+	Flatten(root, -1, channel_maps, bone_namer);
+	transforms_.resize(nodes_.size());
+	cursors_.assign(nodes_.size(), Cursor{ 0, 0, 0 });
+}
+
+// depth first, so a node is appended before any of its children
+void Skeleton::Flatten(aiNode *node, int parent, const vector<std::map<string, int>> &channel_maps, Namer &bone_namer) {
+	string name = node->mName.C_Str();
+	Node flat;
+	flat.parent = parent;
+	flat.rest = mat4_from_aimatrix4x4(node->mTransformation);
+	flat.bone = bone_namer.map().count(name) ? bone_namer.map()[name] : -1;
+	for (const auto &channel_map : channel_maps) {
+		auto it = channel_map.find(name);
+		flat.channels.push_back(it == channel_map.end() ? -1 : it->second);
+	}
+	int index = (int)nodes_.size();
+	nodes_.push_back(flat);
+	for (uint32_t i = 0; i < node->mNumChildren; i++) {
+		Flatten(node->mChildren[i], index, channel_maps, bone_namer);
+	}
+}
+
+void Skeleton::Evaluate(uint32_t animation_id, double ticks, const vector<mat4> &bone_offsets, vector<mat4> &bone_matrices) {
+	auto animation = animations_[animation_id];
+	// the cursors point into another clip's keys
+	if (animation_id != cursor_animation_) {
+		cursors_.assign(nodes_.size(), Cursor{ 0, 0, 0 });
+		cursor_animation_ = animation_id;
+	}
+	for (size_t i = 0; i < nodes_.size(); i++) {
+		const Node &node = nodes_[i];
+		int channel_id = node.channels[animation_id];
+		mat4 local;
+		if (channel_id >= 0) {
+			auto channel = animation->mChannels[channel_id];
+			Cursor &cursor = cursors_[i];
+			local = InterpolateTranslationMatrix(channel->mPositionKeys, channel->mNumPositionKeys, ticks, &cursor.position)
+				* InterpolateRotationMatrix(channel->mRotationKeys, channel->mNumRotationKeys, ticks, &cursor.rotation)
+				* InterpolateScalingMatrix(channel->mScalingKeys, channel->mNumScalingKeys, ticks, &cursor.scaling);
+		} else {
+			local = node.rest;
+		}
+		transforms_[i] = node.parent < 0 ? local : transforms_[node.parent] * local;
+		if (node.bone >= 0) bone_matrices[node.bone] = transforms_[i] * bone_offsets[node.bone];
+	}
+}
+
+int Skeleton::size() const {
+	return (int)nodes_.size();
+}
+
+void Skeleton::EvaluateRecursively(aiAnimation *animation, uint32_t animation_id, aiNode *node, mat4 transform, double ticks,
+	std::map<pair<uint32_t, string>, uint32_t> &channel_map, Namer &bone_namer,
+	const vector<mat4> &bone_offsets, vector<mat4> &bone_matrices) {
+	string node_name = node->mName.C_Str();
+	mat4 current_transform;
+	if (channel_map.count(pair<uint32_t, string>(animation_id, node_name))) {
+		uint32_t channel_id = channel_map[pair<uint32_t, string>(animation_id, node_name)];
+		auto channel = animation->mChannels[channel_id];
+		current_transform = InterpolateTranslationMatrix(channel->mPositionKeys, channel->mNumPositionKeys, ticks)
+			* InterpolateRotationMatrix(channel->mRotationKeys, channel->mNumRotationKeys, ticks)
+			* InterpolateScalingMatrix(channel->mScalingKeys, channel->mNumScalingKeys, ticks);
+	} else {
+		current_transform = mat4_from_aimatrix4x4(node->mTransformation);
+	}
+	if (bone_namer.map().count(node_name)) {
+		uint32_t i = bone_namer.map()[node_name];
+		bone_matrices[i] = transform * current_transform * bone_offsets[i];
+	}
+	for (uint32_t i = 0; i < node->mNumChildren; i++) {
+		EvaluateRecursively(animation, animation_id, node->mChildren[i], transform * current_transform, ticks,
+			channel_map, bone_namer, bone_offsets, bone_matrices);
+	}
+}
+
+void Skeleton::Benchmark(const string &name, aiNode *root, aiAnimation **animations, uint32_t animation_count,
+	Namer &bone_namer, const vector<mat4> &bone_offsets, int frames) {
+	if (animation_count == 0 || frames <= 0) return;
+	std::map<pair<uint32_t, string>, uint32_t> channel_map;
+	for (uint32_t j = 0; j < animations[0]->mNumChannels; j++) {
+		channel_map[pair<uint32_t, string>(0, animations[0]->mChannels[j]->mNodeName.C_Str())] = j;
+	}
+	Skeleton skeleton(root, animations, animation_count, bone_namer);
+	vector<mat4> bone_matrices(bone_namer.total());
+	double duration = std::max(animations[0]->mDuration, 1.0);
+
+	// the same sweep through the clip for both
+	auto time = [&](bool flattened) -> double {
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < frames; i++) {
+			double ticks = duration * i / frames;
+			if (flattened) skeleton.Evaluate(0, ticks, bone_offsets, bone_matrices);
+			else EvaluateRecursively(animations[0], 0, root, mat4(1), ticks, channel_map, bone_namer, bone_offsets, bone_matrices);
+		}
+		return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / frames;
+	};
+	double recursive_us = time(false);
+	double flattened_us = time(true);
+	std::cout << "skeleton " << name << ": " << skeleton.size() << " nodes, " << bone_namer.total() << " bones, recursive "
+		<< recursive_us << " us, flattened " << flattened_us << " us per update" << std::endl;
+}
+
+// a tree of bones, three children per node, every bone animated with a key per tick over 120 ticks
+void Skeleton::Benchmark(int bones, int frames) {
+	const int keys = 120;
+	Namer bone_namer;
+	vector<aiNode *> nodes(std::max(bones, 1));
+	vector<int> child_count(nodes.size(), 0);
+	for (size_t i = 1; i < nodes.size(); i++) child_count[(i - 1) / 3]++;
+	for (size_t i = 0; i < nodes.size(); i++) {
+		string name = "bone" + std::to_string(i);
+		nodes[i] = new aiNode(name);
+		bone_namer.Name(name);
+		if (child_count[i] > 0) nodes[i]->mChildren = new aiNode *[child_count[i]];
+	}
+	for (size_t i = 1; i < nodes.size(); i++) {
+		aiNode *parent = nodes[(i - 1) / 3];
+		nodes[i]->mParent = parent;
+		parent->mChildren[parent->mNumChildren++] = nodes[i];
+	}
+
+	aiAnimation *animation = new aiAnimation();
+	animation->mDuration = keys - 1;
+	animation->mTicksPerSecond = 30;
+	animation->mNumChannels = (unsigned int)nodes.size();
+	animation->mChannels = new aiNodeAnim *[nodes.size()];
+	for (size_t i = 0; i < nodes.size(); i++) {
+		aiNodeAnim *channel = new aiNodeAnim();
+		channel->mNodeName = nodes[i]->mName;
+		channel->mNumPositionKeys = channel->mNumRotationKeys = channel->mNumScalingKeys = keys;
+		channel->mPositionKeys = new aiVectorKey[keys];
+		channel->mRotationKeys = new aiQuatKey[keys];
+		channel->mScalingKeys = new aiVectorKey[keys];
+		for (int k = 0; k < keys; k++) {
+			float angle = 0.05f * k;
+			channel->mPositionKeys[k] = aiVectorKey(k, aiVector3D(0, 1, 0));
+			channel->mRotationKeys[k] = aiQuatKey(k, aiQuaternion(aiVector3D(0, 0, 1), angle));
+			channel->mScalingKeys[k] = aiVectorKey(k, aiVector3D(1, 1, 1));
+		}
+		animation->mChannels[i] = channel;
+	}
+
+	vector<mat4> bone_offsets(nodes.size(), mat4(1));
+	Benchmark(std::to_string(bones) + " bone rig", nodes[0], &animation, 1, bone_namer, bone_offsets, frames);
+	// both own what hangs below them
+	delete animation;
+	delete nodes[0];
+}
+
+// a rig with 120 keys per channel is too short to show the difference, this samples a single
+// translation channel of 100 up to 100000 keys
+void Skeleton::BenchmarkSampling(int samples) {
+	if (samples <= 0) return;
+	for (uint32_t n = 100; n <= 100000; n *= 10) {
+		vector<aiVectorKey> keys(n);
+		for (uint32_t k = 0; k < n; k++) keys[k] = aiVectorKey(k, aiVector3D((float)k, 0, 0));
+
+		// one sweep through the clip at a constant rate, as playback would
+		auto time = [&](bool use_cursor) -> double {
+			uint32_t cursor = 0;
+			float sink = 0;
+			auto start = std::chrono::steady_clock::now();
+			for (int i = 0; i < samples; i++) {
+				double ticks = (n - 1) * (i + 0.5) / samples;
+				sink += InterpolateTranslationMatrix(keys.data(), n, ticks, use_cursor ? &cursor : nullptr)[3][0];
+			}
+			double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / samples;
+			// keeps the loop from being optimized away
+			if (sink < 0) std::cout << sink;
+			return ns;
+		};
+		double search_ns = time(false);
+		double cursor_ns = time(true);
+		std::cout << "sampling " << n << " keys: binary search " << search_ns << " ns, cursor " << cursor_ns << " ns per sample" << std::endl;
+	}
+}
+
+template <typename Key>
+uint32_t Skeleton::FindKey(const Key *keys, uint32_t n, double ticks, uint32_t *cursor) {
+	if (cursor && *cursor < n - 1 && keys[*cursor].mTime <= ticks) {
+		uint32_t i = *cursor;
+		for (uint32_t steps = 0; steps < kMaxCursorSteps && keys[i + 1].mTime <= ticks; steps++) i++;
+		if (keys[i + 1].mTime > ticks) {
+			*cursor = i;
+			return i;
+		}
+	}
+
+	// first sample, a seek, or the clip looped
+	auto right_ptr = std::upper_bound(keys, keys + n, ticks, [](double t, const Key &key) {
+		return t < key.mTime;
+	});
+	uint32_t i = (uint32_t)(right_ptr - keys) - 1;
+	if (cursor) *cursor = i;
+	return i;
+}
+
+mat4 Skeleton::InterpolateTranslationMatrix(aiVectorKey *keys, uint32_t n, double ticks, uint32_t *cursor) {
+	static auto mat4_from_aivector3d = [](aiVector3D vector) -> mat4 {
+		return translate(mat4(1), vec3(vector.x, vector.y, vector.z));
+	};
+	if (n == 0) return mat4(1);
+	if (n == 1) return mat4_from_aivector3d(keys->mValue);
+	if (ticks <= keys[0].mTime) return mat4_from_aivector3d(keys[0].mValue);
+	if (keys[n - 1].mTime <= ticks) return mat4_from_aivector3d(keys[n - 1].mValue);
+
+	auto left_ptr = keys + FindKey(keys, n, ticks, cursor);
+	auto right_ptr = left_ptr + 1;
+
+	float factor = (ticks - left_ptr->mTime) / (right_ptr->mTime - left_ptr->mTime);
+	return mat4_from_aivector3d(left_ptr->mValue * (1.0f - factor) + right_ptr->mValue * factor);
+}
+
+mat4 Skeleton::InterpolateRotationMatrix(aiQuatKey *keys, uint32_t n, double ticks, uint32_t *cursor) {
+	static auto mat4_from_aiquaternion = [](aiQuaternion quaternion) -> mat4 {
+		auto rotation_matrix = quaternion.GetMatrix();
+		mat4 res(1);
+		for (int i = 0; i < 3; i++) for (int j = 0; j < 3; j++) res[j][i] = rotation_matrix[i][j];
+		return res;
+	};
+	if (n == 0) return mat4(1);
+	if (n == 1) return mat4_from_aiquaternion(keys->mValue);
+	if (ticks <= keys[0].mTime) return mat4_from_aiquaternion(keys[0].mValue);
+	if (keys[n - 1].mTime <= ticks) return mat4_from_aiquaternion(keys[n - 1].mValue);
+
+	auto left_ptr = keys + FindKey(keys, n, ticks, cursor);
+	auto right_ptr = left_ptr + 1;
+
+	double factor = (ticks - left_ptr->mTime) / (right_ptr->mTime - left_ptr->mTime);
+	aiQuaternion out;
+	aiQuaternion::Interpolate(out, left_ptr->mValue, right_ptr->mValue, factor);
+	return mat4_from_aiquaternion(out);
+}
+
+mat4 Skeleton::InterpolateScalingMatrix(aiVectorKey *keys, uint32_t n, double ticks, uint32_t *cursor) {
+	static auto mat4_from_aivector3d = [](aiVector3D vector) -> mat4 {
+		return scale(mat4(1), vec3(vector.x, vector.y, vector.z));
+	};
+	if (n == 0) return mat4(1);
+	if (n == 1) return mat4_from_aivector3d(keys->mValue);
+	if (ticks <= keys[0].mTime) return mat4_from_aivector3d(keys[0].mValue);
+	if (keys[n - 1].mTime <= ticks) return mat4_from_aivector3d(keys[n - 1].mValue);
+
+	auto left_ptr = keys + FindKey(keys, n, ticks, cursor);
+	auto right_ptr = left_ptr + 1;
+
+	float factor = (ticks - left_ptr->mTime) / (right_ptr->mTime - left_ptr->mTime);
+	return mat4_from_aivector3d(left_ptr->mValue * (1.0f - factor) + right_ptr->mValue * factor);
+}
@@ -1,3 +1,4 @@
+#include <chrono>
 #include <iostream>
 
 #include <glad/glad.h>
@@ -12,25 +13,40 @@ using std::string;
 using std::shared_ptr;
 using std::make_shared;
 using std::vector;
-using std::pair;
 using namespace Assimp;
 using namespace glm;
 
-SpriteModel::SpriteModel(boost::filesystem::path path) : directory_path_(path.parent_path()) {
+SpriteModel::SpriteModel(boost::filesystem::path path, int max_batch_bones)
+	: directory_path_(path.parent_path()), max_batch_bones_(max_batch_bones), draw_count_(0), palette_overflow_logged_(false), bone_update_ms_(0) {
 	scene_ = aiImportFile(path.string().c_str(), aiProcess_CalcTangentSpace | aiProcess_FlipUVs | aiProcess_Triangulate);
 	shader_ptr_ = shared_ptr<Shader>(new Shader(directory_path_ / "model.vert", directory_path_ / "model.frag"));
-
-	animation_channel_map_.clear();
-	for (int i = 0; i < scene_->mNumAnimations; i++) {
-		auto animation = scene_->mAnimations[i];
-		for (int j = 0; j < animation->mNumChannels; j++) {
-			auto channel = animation->mChannels[j];
-			animation_channel_map_[pair<uint32_t, string>(i, channel->mNodeName.C_Str())] = j;
-		}
-	}
+	model_matrix_uniform_ = shader_ptr_->Uniform("uModelMatrix");
+	view_matrix_uniform_ = shader_ptr_->Uniform("uViewMatrix");
+	projection_matrix_uniform_ = shader_ptr_->Uniform("uProjectionMatrix");
+	bone_palette_uniform_ = shader_ptr_->Uniform("uBonePalette");
+	bone_palette_base_uniform_ = shader_ptr_->Uniform("uBonePaletteBase");
+	diffuse_texture_uniform_ = shader_ptr_->Uniform("uDiffuseTexture");
 
 	RecursivelyInitNodes(scene_->mRootNode);
 	bone_matrices_.resize(bone_namer_.total());
+	// after the meshes, which name the bones
+	skeleton_ptr_.reset(new Skeleton(scene_->mRootNode, scene_->mAnimations, scene_->mNumAnimations, bone_namer_));
+
+	// the palette holds the whole skeleton once, or every batch's sub-palette
+	int batches = 0, palette_bones = 0;
+	for (const auto &mesh_ptr : mesh_ptrs_) {
+		for (const auto &batch : mesh_ptr->batches()) {
+			batches++;
+			palette_bones += (int)batch.bones.size();
+		}
+	}
+	if (max_batch_bones_ <= 0) palette_bones = bone_namer_.total();
+	bone_palette_ptr_.reset(new BonePalette(std::max(palette_bones, 1)));
+	std::cout << bone_namer_.total() << " bones, " << mesh_ptrs_.size() << " meshes in " << batches << " draws";
+	if (max_batch_bones_ > 0) std::cout << " of at most " << std::max(max_batch_bones_, 3 * kMaxBonesPerVertex) << " bones";
+	if (bone_palette_ptr_->capacity() < palette_bones) std::cout << ", palette limited to " << bone_palette_ptr_->capacity() << " bones";
+	std::cout << ", " << bone_palette_ptr_->capacity() * 3 * sizeof(vec4) << " bytes per frame ("
+		<< bone_namer_.total() * sizeof(mat4) << " as one mat4 array)" << std::endl;
 }
 
 SpriteModel::~SpriteModel() {
@@ -41,7 +57,7 @@ void SpriteModel::RecursivelyInitNodes(aiNode *node) {
 	if (node->mName != aiString("objTwoHand13_SM") && node->mName != aiString("Plane001") && node->mName != aiString("Plane002") && node->mName != aiString("obj53002_LynM001")) {
 		for (int i = 0; i < node->mNumMeshes; i++) {
 			auto mesh = scene_->mMeshes[node->mMeshes[i]];
-			mesh_ptrs_.emplace_back(make_shared<Mesh>(directory_path_, mesh, scene_, bone_namer_, bone_offsets_));
+			mesh_ptrs_.emplace_back(make_shared<Mesh>(directory_path_, mesh, scene_, bone_namer_, bone_offsets_, max_batch_bones_));
 		}
 	}
 	for (int i = 0; i < node->mNumChildren; i++) {
@@ -49,130 +65,92 @@ void SpriteModel::RecursivelyInitNodes(aiNode *node) {
 	}
 }
 
-glm::mat4 SpriteModel::InterpolateTranslationMatrix(aiVectorKey *keys, uint32_t n, double ticks) {
-	static auto mat4_from_aivector3d = [](aiVector3D vector) -> mat4 {
-		return translate(mat4(1), vec3(vector.x, vector.y, vector.z));
-	};
-	if (n == 0) return mat4(1);
-	if (n == 1) return mat4_from_aivector3d(keys->mValue);
-	if (ticks <= keys[0].mTime) return mat4_from_aivector3d(keys[0].mValue);
-	if (keys[n - 1].mTime <= ticks) return mat4_from_aivector3d(keys[n - 1].mValue);
-
-	aiVectorKey anchor;
-	anchor.mTime = ticks;
-	auto right_ptr = std::upper_bound(keys, keys + n, anchor, [](const aiVectorKey &a, const aiVectorKey &b) {
-		return a.mTime < b.mTime;
-	});
-	auto left_ptr = right_ptr - 1;
-
-	float factor = (ticks - left_ptr->mTime) / (right_ptr->mTime - left_ptr->mTime);
-	return mat4_from_aivector3d(left_ptr->mValue * (1.0f - factor) + right_ptr->mValue * factor);
+// all palettes of the frame are written before the first draw, the buffer cannot be drawn from while mapped
+void SpriteModel::UploadBoneMatrices() {
+	bone_palette_ptr_->Begin();
+	int skeleton_base = -1;
+	batch_bases_.clear();
+	for (const auto &mesh_ptr : mesh_ptrs_) {
+		for (const auto &batch : mesh_ptr->batches()) {
+			if (!mesh_ptr->partitioned()) {
+				if (skeleton_base < 0) skeleton_base = bone_palette_ptr_->Add(bone_matrices_);
+				batch_bases_.push_back(skeleton_base);
+				continue;
+			}
+			batch_palette_.resize(batch.bones.size());
+			for (size_t i = 0; i < batch.bones.size(); i++) batch_palette_[i] = bone_matrices_[batch.bones[i]];
+			batch_bases_.push_back(bone_palette_ptr_->Add(batch_palette_));
+		}
+	}
+	bone_palette_ptr_->End();
+	bone_palette_ptr_->Bind(1);
+	shader_ptr_->SetUniform<int32_t>(bone_palette_uniform_, 1);
 }
 
-glm::mat4 SpriteModel::InterpolateRotationMatrix(aiQuatKey *keys, uint32_t n, double ticks) {
-	static auto mat4_from_aiquaternion = [](aiQuaternion quaternion) -> mat4 {
-		auto rotation_matrix = quaternion.GetMatrix();
-		mat4 res(1);
-		for (int i = 0; i < 3; i++) for (int j = 0; j < 3; j++) res[j][i] = rotation_matrix[i][j];
-		return res;
-	};
-	if (n == 0) return mat4(1);
-	if (n == 1) return mat4_from_aiquaternion(keys->mValue);
-	if (ticks <= keys[0].mTime) return mat4_from_aiquaternion(keys[0].mValue);
-	if (keys[n - 1].mTime <= ticks) return mat4_from_aiquaternion(keys[n - 1].mValue);
-
-	aiQuatKey anchor;
-	anchor.mTime = ticks;
-	auto right_ptr = std::upper_bound(keys, keys + n, anchor, [](const aiQuatKey &a, const aiQuatKey &b) {
-		return a.mTime < b.mTime;
-	});
-	auto left_ptr = right_ptr - 1;
-
-	double factor = (ticks - left_ptr->mTime) / (right_ptr->mTime - left_ptr->mTime);
-	aiQuaternion out;
-	aiQuaternion::Interpolate(out, left_ptr->mValue, right_ptr->mValue, factor);
-	return mat4_from_aiquaternion(out);
+void SpriteModel::DrawMeshes() {
+	size_t next = 0;
+	draw_count_ = 0;
+	for (const auto &mesh_ptr : mesh_ptrs_) {
+		mesh_ptr->Bind();
+		for (size_t i = 0; i < mesh_ptr->batches().size(); i++) {
+			int base = batch_bases_[next++];
+			// its bones did not fit this frame; any other base would skin it with someone else's bones
+			if (base < 0) {
+				if (!palette_overflow_logged_) {
+					std::cout << "bone palette full at " << bone_palette_ptr_->capacity() << " bones, skipping draws" << std::endl;
+					palette_overflow_logged_ = true;
+				}
+				continue;
+			}
+			shader_ptr_->SetUniform<int32_t>(bone_palette_base_uniform_, base);
+			mesh_ptr->Draw(i);
+			draw_count_++;
+		}
+	}
+	glBindVertexArray(0);
 }
 
-glm::mat4 SpriteModel::InterpolateScalingMatrix(aiVectorKey *keys, uint32_t n, double ticks) {
-	static auto mat4_from_aivector3d = [](aiVector3D vector) -> mat4 {
-		return scale(mat4(1), vec3(vector.x, vector.y, vector.z));
-	};
-	if (n == 0) return mat4(1);
-	if (n == 1) return mat4_from_aivector3d(keys->mValue);
-	if (ticks <= keys[0].mTime) return mat4_from_aivector3d(keys[0].mValue);
-	if (keys[n - 1].mTime <= ticks) return mat4_from_aivector3d(keys[n - 1].mValue);
-
-	aiVectorKey anchor;
-	anchor.mTime = ticks;
-	auto right_ptr = std::upper_bound(keys, keys + n, anchor, [](const aiVectorKey &a, const aiVectorKey &b) {
-		return a.mTime < b.mTime;
-	});
-	auto left_ptr = right_ptr - 1;
-
-	float factor = (ticks - left_ptr->mTime) / (right_ptr->mTime - left_ptr->mTime);
-	return mat4_from_aivector3d(left_ptr->mValue * (1.0f - factor) + right_ptr->mValue * factor);
+int SpriteModel::draw_count() const {
+	return draw_count_;
 }
 
-void SpriteModel::RecursivelyUpdateBoneMatrices(int animation_id, aiNode *node, glm::mat4 transform, double ticks) {
-	static auto mat4_from_aimatrix4x4 = [](aiMatrix4x4 matrix) -> mat4 {
-		mat4 res;
-		for (int i = 0; i < 4; i++) for (int j = 0; j < 4; j++) res[j][i] = matrix[i][j];
-		return res;
-	};
-	string node_name = node->mName.C_Str();
-	auto animation = scene_->mAnimations[animation_id];
-	mat4 current_transform;
-	if (animation_channel_map_.count(pair<uint32_t, string>(animation_id, node_name))) {
-		uint32_t channel_id = animation_channel_map_[pair<uint32_t, string>(animation_id, node_name)];
-		auto channel = animation->mChannels[channel_id];
-
-		// translation matrix
-		mat4 translation_matrix = InterpolateTranslationMatrix(channel->mPositionKeys, channel->mNumPositionKeys, ticks);
-		// rotation matrix
-		mat4 rotation_matrix = InterpolateRotationMatrix(channel->mRotationKeys, channel->mNumRotationKeys, ticks);
-		// scaling matrix
-		mat4 scaling_matrix = InterpolateScalingMatrix(channel->mScalingKeys, channel->mNumScalingKeys, ticks);
-
-		current_transform = translation_matrix * rotation_matrix * scaling_matrix;
-	}
-	else {
-		current_transform = mat4_from_aimatrix4x4(node->mTransformation);
-	}
-	if (bone_namer_.map().count(node_name)) {
-		uint32_t i = bone_namer_.map()[node_name];
-		bone_matrices_[i] = transform * current_transform * bone_offsets_[i];
-	}
-	for (int i = 0; i < node->mNumChildren; i++) {
-		RecursivelyUpdateBoneMatrices(animation_id, node->mChildren[i], transform * current_transform, ticks);
-	}
+size_t SpriteModel::bone_upload_bytes() const {
+	return bone_palette_ptr_->uploaded_bytes();
+}
+
+void SpriteModel::Benchmark(int frames) {
+	Skeleton::Benchmark("sprite", scene_->mRootNode, scene_->mAnimations, scene_->mNumAnimations, bone_namer_, bone_offsets_, frames);
+}
+
+double SpriteModel::bone_update_ms() const {
+	return bone_update_ms_;
 }
 
 void SpriteModel::Draw(uint32_t animation_id, std::weak_ptr<Camera> camera_ptr, double time) {
-	RecursivelyUpdateBoneMatrices(animation_id, scene_->mRootNode, mat4(1), time * scene_->mAnimations[animation_id]->mTicksPerSecond);
+	auto start = std::chrono::steady_clock::now();
+	skeleton_ptr_->Evaluate(animation_id, time * scene_->mAnimations[animation_id]->mTicksPerSecond, bone_offsets_, bone_matrices_);
+	bone_update_ms_ = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
 	shader_ptr_->Use();
 	glm::mat4 model;
 	model = glm::rotate(model, glm::radians(90.0f), glm::vec3(1.0, 0.0, 0.0));
 	model = glm::scale(model, glm::vec3(0.1, 0.1, 0.1));
-	shader_ptr_->SetUniform<mat4>("uModelMatrix", model);
-	shader_ptr_->SetUniform<mat4>("uViewMatrix", camera_ptr.lock()->get_view_matrix());
-	shader_ptr_->SetUniform<mat4>("uProjectionMatrix", camera_ptr.lock()->get_projection_matrix());
-	shader_ptr_->SetUniform<vector<mat4>>("uBoneMatrices", bone_matrices_);
-
-	for (const auto &mesh_ptr : mesh_ptrs_) {
-		mesh_ptr->Draw(shader_ptr_);
-	}
+	shader_ptr_->SetUniform<mat4>(model_matrix_uniform_, model);
+	UploadBoneMatrices();
+	// every mesh samples unit 0, set once instead of per mesh
+	shader_ptr_->SetUniform<int32_t>(diffuse_texture_uniform_, 0);
+	// latched after the upload, which may wait on a fence, so the newest pose is drawn
+	shader_ptr_->SetUniform<mat4>(view_matrix_uniform_, camera_ptr.lock()->get_view_matrix());
+	shader_ptr_->SetUniform<mat4>(projection_matrix_uniform_, camera_ptr.lock()->get_projection_matrix());
+	DrawMeshes();
 }
 
 void SpriteModel::Draw(std::weak_ptr<Camera> camera_ptr) {
 	std::fill(bone_matrices_.begin(), bone_matrices_.end(), mat4(1));
 	shader_ptr_->Use();
-	shader_ptr_->SetUniform<mat4>("uModelMatrix", rotate(mat4(1), -pi<float>() / 2.0f, vec3(1, 0, 0)));
-	shader_ptr_->SetUniform<mat4>("uViewMatrix", camera_ptr.lock()->get_view_matrix());
-	shader_ptr_->SetUniform<mat4>("uProjectionMatrix", camera_ptr.lock()->get_projection_matrix());
-	shader_ptr_->SetUniform<vector<mat4>>("uBoneMatrices", bone_matrices_);
-
-	for (const auto &mesh_ptr : mesh_ptrs_) {
-		mesh_ptr->Draw(shader_ptr_);
-	}
+	shader_ptr_->SetUniform<mat4>(model_matrix_uniform_, rotate(mat4(1), -pi<float>() / 2.0f, vec3(1, 0, 0)));
+	UploadBoneMatrices();
+	shader_ptr_->SetUniform<int32_t>(diffuse_texture_uniform_, 0);
+	shader_ptr_->SetUniform<mat4>(view_matrix_uniform_, camera_ptr.lock()->get_view_matrix());
+	shader_ptr_->SetUniform<mat4>(projection_matrix_uniform_, camera_ptr.lock()->get_projection_matrix());
+	DrawMeshes();
 }
@@ -0,0 +1,201 @@
+#include <cmath>
+#include <algorithm>
+
+#include <opencv2/calib3d.hpp>
+
+#include "square_pose.h"
+
+namespace {
+
+// Structure-of-arrays layout: every field is a run of n doubles, one lane per marker.
+enum Field {
+	kU0 = 0, // normalized corner x, 4 fields
+	kV0 = 4, // normalized corner y, 4 fields
+	kRa = 8, // first rotation, 9 fields, row-major
+	kRb = kRa + 9, // second rotation
+	kTa = kRb + 9, // first translation, 3 fields
+	kTb = kTa + 3, // second translation
+	kEa = kTb + 3, // first reprojection error
+	kEb = kEa + 1, // second reprojection error
+	kFieldCount = kEb + 1
+};
+
+// Homography of the canonical square, its Jacobian at the square center and the two IPPE rotations.
+void SolveRotations(double *soa, int n, double half_length) {
+	const double *__restrict x0 = soa + (kU0 + 0) * n, *__restrict y0 = soa + (kV0 + 0) * n;
+	const double *__restrict x1 = soa + (kU0 + 1) * n, *__restrict y1 = soa + (kV0 + 1) * n;
+	const double *__restrict x2 = soa + (kU0 + 2) * n, *__restrict y2 = soa + (kV0 + 2) * n;
+	const double *__restrict x3 = soa + (kU0 + 3) * n, *__restrict y3 = soa + (kV0 + 3) * n;
+	double *__restrict ra[9], *__restrict rb[9];
+	for (int k = 0; k < 9; k++) {
+		ra[k] = soa + (kRa + k) * n;
+		rb[k] = soa + (kRb + k) * n;
+	}
+	const double inv_length = 0.5 / half_length;
+
+	for (int i = 0; i < n; i++) {
+		// unit square (0,0),(1,0),(1,1),(0,1) onto the four corners (Heckbert's square-to-quad)
+		double sx = x0[i] - x1[i] + x2[i] - x3[i];
+		double sy = y0[i] - y1[i] + y2[i] - y3[i];
+		double dx1 = x1[i] - x2[i], dx2 = x3[i] - x2[i];
+		double dy1 = y1[i] - y2[i], dy2 = y3[i] - y2[i];
+		double den = 1.0 / (dx1 * dy2 - dx2 * dy1);
+		double g = (sx * dy2 - dx2 * sy) * den;
+		double h = (dx1 * sy - sx * dy1) * den;
+		double a = x1[i] - x0[i] + g * x1[i], b = x3[i] - x0[i] + h * x3[i];
+		double d = y1[i] - y0[i] + g * y1[i], e = y3[i] - y0[i] + h * y3[i];
+
+		// compose with the marker plane -> unit square map (s = X / L + 1/2, t = -Y / L + 1/2), scaled to H22 = 1
+		double w = 1.0 / (0.5 * (g + h) + 1.0);
+		double h00 = a * inv_length * w, h01 = -b * inv_length * w, h02 = (0.5 * (a + b) + x0[i]) * w;
+		double h10 = d * inv_length * w, h11 = -e * inv_length * w, h12 = (0.5 * (d + e) + y0[i]) * w;
+		double h20 = g * inv_length * w, h21 = -h * inv_length * w;
+
+		// (p, q) is the image of the marker center, J the Jacobian of the homography there
+		double p = h02, q = h12;
+		double j00 = h00 - h20 * p, j01 = h01 - h21 * p;
+		double j10 = h10 - h20 * q, j11 = h11 - h21 * q;
+
+		// Rv rotates the line of sight through (p, q, 1) onto the z axis (transposed)
+		double nrm = 1.0 / std::sqrt(p * p + q * q + 1.0);
+		double ax = p * nrm, ay = q * nrm;
+		double c = 1.0 / (1.0 + nrm);
+		double rv00 = 1.0 - ax * ax * c, rv01 = -ax * ay * c, rv02 = ax;
+		double rv10 = rv01, rv11 = 1.0 - ay * ay * c, rv12 = ay;
+		double rv20 = -ax, rv21 = -ay, rv22 = 1.0 - (ax * ax + ay * ay) * c;
+
+		double b00 = rv00 - p * rv20, b01 = rv01 - p * rv21;
+		double b10 = rv10 - q * rv20, b11 = rv11 - q * rv21;
+		double dt = 1.0 / (b00 * b11 - b01 * b10);
+		double a00 = dt * (b11 * j00 - b01 * j10), a01 = dt * (b11 * j01 - b01 * j11);
+		double a10 = dt * (b00 * j10 - b10 * j00), a11 = dt * (b00 * j11 - b10 * j01);
+
+		// largest singular value of A
+		double ata00 = a00 * a00 + a01 * a01;
+		double ata01 = a00 * a10 + a01 * a11;
+		double ata11 = a10 * a10 + a11 * a11;
+		double gamma = std::sqrt(0.5 * (ata00 + ata11 + std::sqrt((ata00 - ata11) * (ata00 - ata11) + 4.0 * ata01 * ata01)));
+
+		double r00 = a00 / gamma, r01 = a01 / gamma;
+		double r10 = a10 / gamma, r11 = a11 / gamma;
+		double b0 = std::sqrt(std::max(0.0, 1.0 - r00 * r00 - r10 * r10));
+		double b1 = std::copysign(std::sqrt(std::max(0.0, 1.0 - r01 * r01 - r11 * r11)), -r00 * r01 - r10 * r11);
+		double c0 = b1 * r10 - b0 * r11, c1 = b0 * r01 - b1 * r00, c2 = r00 * r11 - r01 * r10;
+
+		ra[0][i] = r00 * rv00 + r10 * rv01 + b0 * rv02;
+		ra[1][i] = r01 * rv00 + r11 * rv01 + b1 * rv02;
+		ra[2][i] = c0 * rv00 + c1 * rv01 + c2 * rv02;
+		ra[3][i] = r00 * rv10 + r10 * rv11 + b0 * rv12;
+		ra[4][i] = r01 * rv10 + r11 * rv11 + b1 * rv12;
+		ra[5][i] = c0 * rv10 + c1 * rv11 + c2 * rv12;
+		ra[6][i] = r00 * rv20 + r10 * rv21 + b0 * rv22;
+		ra[7][i] = r01 * rv20 + r11 * rv21 + b1 * rv22;
+		ra[8][i] = c0 * rv20 + c1 * rv21 + c2 * rv22;
+
+		// second solution: the plane normal mirrored about the line of sight
+		rb[0][i] = r00 * rv00 + r10 * rv01 - b0 * rv02;
+		rb[1][i] = r01 * rv00 + r11 * rv01 - b1 * rv02;
+		rb[2][i] = -c0 * rv00 - c1 * rv01 + c2 * rv02;
+		rb[3][i] = r00 * rv10 + r10 * rv11 - b0 * rv12;
+		rb[4][i] = r01 * rv10 + r11 * rv11 - b1 * rv12;
+		rb[5][i] = -c0 * rv10 - c1 * rv11 + c2 * rv12;
+		rb[6][i] = r00 * rv20 + r10 * rv21 - b0 * rv22;
+		rb[7][i] = r01 * rv20 + r11 * rv21 - b1 * rv22;
+		rb[8][i] = -c0 * rv20 - c1 * rv21 + c2 * rv22;
+	}
+}
+
+// Least-squares translation for a given rotation and the RMS reprojection error in pixels.
+void SolveTranslations(double *soa, int n, int r_field, int t_field, int e_field, double half_length, double fx, double fy) {
+	const double model_x[4] = { -half_length, half_length, half_length, -half_length };
+	const double model_y[4] = { half_length, half_length, -half_length, -half_length };
+	const double *__restrict u[4], *__restrict v[4], *__restrict r[9];
+	for (int k = 0; k < 4; k++) {
+		u[k] = soa + (kU0 + k) * n;
+		v[k] = soa + (kV0 + k) * n;
+	}
+	for (int k = 0; k < 9; k++) r[k] = soa + (r_field + k) * n;
+	double *__restrict tx = soa + (t_field + 0) * n;
+	double *__restrict ty = soa + (t_field + 1) * n;
+	double *__restrict tz = soa + (t_field + 2) * n;
+	double *__restrict err = soa + e_field * n;
+
+	for (int i = 0; i < n; i++) {
+		// normal equations of [1 0 -u; 0 1 -v] t = [u rz - rx; v rz - ry]
+		double ata02 = 0, ata12 = 0, ata22 = 0, atb0 = 0, atb1 = 0, atb2 = 0;
+		for (int k = 0; k < 4; k++) {
+			double rx = r[0][i] * model_x[k] + r[1][i] * model_y[k];
+			double ry = r[3][i] * model_x[k] + r[4][i] * model_y[k];
+			double rz = r[6][i] * model_x[k] + r[7][i] * model_y[k];
+			double bx = u[k][i] * rz - rx;
+			double by = v[k][i] * rz - ry;
+			ata02 -= u[k][i];
+			ata12 -= v[k][i];
+			ata22 += u[k][i] * u[k][i] + v[k][i] * v[k][i];
+			atb0 += bx;
+			atb1 += by;
+			atb2 -= u[k][i] * bx + v[k][i] * by;
+		}
+		const double ata00 = 4.0, ata11 = 4.0;
+		double det = 1.0 / (ata00 * ata11 * ata22 - ata00 * ata12 * ata12 - ata02 * ata02 * ata11);
+		double s00 = ata11 * ata22 - ata12 * ata12, s01 = ata02 * ata12, s02 = -ata02 * ata11;
+		double s11 = ata00 * ata22 - ata02 * ata02, s12 = -ata00 * ata12, s22 = ata00 * ata11;
+		tx[i] = det * (s00 * atb0 + s01 * atb1 + s02 * atb2);
+		ty[i] = det * (s01 * atb0 + s11 * atb1 + s12 * atb2);
+		tz[i] = det * (s02 * atb0 + s12 * atb1 + s22 * atb2);
+
+		double sum = 0;
+		for (int k = 0; k < 4; k++) {
+			double px = r[0][i] * model_x[k] + r[1][i] * model_y[k] + tx[i];
+			double py = r[3][i] * model_x[k] + r[4][i] * model_y[k] + ty[i];
+			double pz = r[6][i] * model_x[k] + r[7][i] * model_y[k] + tz[i];
+			double du = (px / pz - u[k][i]) * fx;
+			double dv = (py / pz - v[k][i]) * fy;
+			sum += du * du + dv * dv;
+		}
+		err[i] = std::sqrt(sum * 0.25);
+	}
+}
+
+}
+
+SquarePoseSolver::SquarePoseSolver(double marker_length) : half_length_(marker_length * 0.5) {
+}
+
+void SquarePoseSolver::Solve(const std::vector<std::vector<cv::Point2f>> &corners, const cv::Mat &camera_matrix, const cv::Mat &dist_coeffs, std::vector<SquarePose> &poses) {
+	int n = (int)corners.size();
+	poses.resize(n);
+	if (n == 0) return;
+
+	distorted_.resize(4 * n);
+	for (int i = 0; i < n; i++)
+		for (int k = 0; k < 4; k++)
+			distorted_[4 * i + k] = corners[i][k];
+	cv::undistortPoints(distorted_, undistorted_, camera_matrix, dist_coeffs);
+
+	soa_.resize(kFieldCount * n);
+	double *soa = soa_.data();
+	for (int i = 0; i < n; i++) {
+		for (int k = 0; k < 4; k++) {
+			soa[(kU0 + k) * n + i] = undistorted_[4 * i + k].x;
+			soa[(kV0 + k) * n + i] = undistorted_[4 * i + k].y;
+		}
+	}
+
+	double fx = camera_matrix.at<double>(0, 0);
+	double fy = camera_matrix.at<double>(1, 1);
+	SolveRotations(soa, n, half_length_);
+	SolveTranslations(soa, n, kRa, kTa, kEa, half_length_, fx, fy);
+	SolveTranslations(soa, n, kRb, kTb, kEb, half_length_, fx, fy);
+
+	for (int i = 0; i < n; i++) {
+		int first = soa[kEb * n + i] < soa[kEa * n + i] ? 1 : 0;
+		for (int s = 0; s < 2; s++) {
+			int src = s ^ first;
+			int r_field = src ? kRb : kRa, t_field = src ? kTb : kTa, e_field = src ? kEb : kEa;
+			for (int k = 0; k < 9; k++) poses[i].rotation[s](k / 3, k % 3) = soa[(r_field + k) * n + i];
+			for (int k = 0; k < 3; k++) poses[i].translation[s][k] = soa[(t_field + k) * n + i];
+			poses[i].reprojection_error[s] = soa[e_field * n + i];
+		}
+	}
+}
@@ -0,0 +1,287 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "streaming_texture.h"
+
+namespace {
+
+// internal format, pixel format for each supported cv type; BGR(A) is stored as is and swizzled
+bool GetFormats(int type, GLenum &internal_format, GLenum &format) {
+	switch (type) {
+	case CV_8UC1: internal_format = GL_R8; format = GL_RED; return true;
+	case CV_8UC2: internal_format = GL_RG8; format = GL_RG; return true;
+	case CV_8UC3: internal_format = GL_RGB8; format = GL_RGB; return true;
+	case CV_8UC4: internal_format = GL_RGBA8; format = GL_RGBA; return true;
+	default: return false;
+	}
+}
+
+// slots start at multiples of this so every upload offset is suitably aligned
+const size_t kSlotAlignment = 256;
+
+}
+
+StreamingTexture::StreamingTexture(Upload upload, int buffers)
+	: texture_(0), width_(0), height_(0), type_(-1), allocations_(0),
+	upload_(upload), mapped_(NULL), image_size_(0), slot_size_(0), next_slot_(0), busy_buffers_(0) {
+	if (upload_ == PERSISTENT && !HasBufferStorage()) upload_ = PIXEL_BUFFER;
+	if (upload_ != DIRECT) {
+		fences_.assign(std::max(2, std::min(buffers, 3)), (GLsync)0);
+		buffers_.assign(upload_ == PERSISTENT ? 1 : fences_.size(), 0);
+	}
+}
+
+StreamingTexture::~StreamingTexture() {
+	ReleaseBuffers();
+	if (texture_) glDeleteTextures(1, &texture_);
+}
+
+bool StreamingTexture::HasImmutableStorage() {
+#if defined(GL_VERSION_4_2)
+	if (GLAD_GL_VERSION_4_2) return true;
+#endif
+#if defined(GL_ARB_texture_storage)
+	if (GLAD_GL_ARB_texture_storage) return true;
+#endif
+	return false;
+}
+
+bool StreamingTexture::HasBufferStorage() {
+#if defined(GL_VERSION_4_4)
+	if (GLAD_GL_VERSION_4_4) return true;
+#endif
+#if defined(GL_ARB_buffer_storage)
+	if (GLAD_GL_ARB_buffer_storage) return true;
+#endif
+	return false;
+}
+
+const char *StreamingTexture::Name(Upload upload) {
+	switch (upload) {
+	case PIXEL_BUFFER: return "pixel buffers";
+	case PERSISTENT: return "persistent mapping";
+	default: return "direct";
+	}
+}
+
+void StreamingTexture::ReleaseBuffers() {
+	for (size_t i = 0; i < fences_.size(); i++) {
+		if (fences_[i]) glDeleteSync(fences_[i]);
+		fences_[i] = 0;
+	}
+	if (mapped_) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers_[0]);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		mapped_ = NULL;
+	}
+	for (size_t i = 0; i < buffers_.size(); i++) {
+		if (buffers_[i]) glDeleteBuffers(1, &buffers_[i]);
+		buffers_[i] = 0;
+	}
+}
+
+// the buffers hold tightly packed rows of exactly one image per slot
+bool StreamingTexture::AllocateBuffers(int width, int height, int type) {
+	ReleaseBuffers();
+	image_size_ = (size_t)width * height * CV_ELEM_SIZE(type);
+	slot_size_ = (image_size_ + kSlotAlignment - 1) / kSlotAlignment * kSlotAlignment;
+	next_slot_ = 0;
+	glGenBuffers((GLsizei)buffers_.size(), &buffers_[0]);
+
+	if (upload_ == PIXEL_BUFFER) {
+		for (size_t i = 0; i < buffers_.size(); i++) {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers_[i]);
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, image_size_, NULL, GL_STREAM_DRAW);
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return true;
+	}
+
+#if defined(GL_VERSION_4_4) || defined(GL_ARB_buffer_storage)
+	// coherent: a memcpy into the mapping is visible to the next command without an explicit flush
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers_[0]);
+	glBufferStorage(GL_PIXEL_UNPACK_BUFFER, slot_size_ * fences_.size(), NULL, flags);
+	mapped_ = (unsigned char *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, slot_size_ * fences_.size(), flags);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+#endif
+	return mapped_ != NULL;
+}
+
+// immutable storage cannot be resized, so a new size always means a new texture object
+void StreamingTexture::Allocate(int width, int height, int type) {
+	GLenum internal_format, format;
+	GetFormats(type, internal_format, format);
+
+	if (texture_) glDeleteTextures(1, &texture_);
+	glGenTextures(1, &texture_);
+	glBindTexture(GL_TEXTURE_2D, texture_);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	if (type == CV_8UC3 || type == CV_8UC4) {
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_R, GL_BLUE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_B, GL_RED);
+	}
+
+	bool immutable = false;
+#if defined(GL_VERSION_4_2) || defined(GL_ARB_texture_storage)
+	if (HasImmutableStorage()) {
+		glTexStorage2D(GL_TEXTURE_2D, 1, internal_format, width, height);
+		immutable = true;
+	}
+#endif
+	if (!immutable) glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, GL_UNSIGNED_BYTE, NULL);
+
+	while (upload_ != DIRECT && !AllocateBuffers(width, height, type)) {
+		ReleaseBuffers();
+		upload_ = upload_ == PERSISTENT ? PIXEL_BUFFER : DIRECT;
+		buffers_.assign(upload_ == PIXEL_BUFFER ? fences_.size() : 0, 0);
+		std::cout << "streaming texture: buffer storage unavailable, using " << Name(upload_) << std::endl;
+	}
+
+	width_ = width;
+	height_ = height;
+	type_ = type;
+	allocations_++;
+}
+
+void StreamingTexture::Update(const cv::Mat &image) {
+	GLenum internal_format, format;
+	if (image.empty() || !GetFormats(image.type(), internal_format, format)) return;
+
+	if (!texture_ || image.cols != width_ || image.rows != height_ || image.type() != type_)
+		Allocate(image.cols, image.rows, image.type());
+	else
+		glBindTexture(GL_TEXTURE_2D, texture_);
+
+	if (upload_ != DIRECT) {
+		UpdateFromBuffer(image, format);
+		if (upload_ != DIRECT) return;
+	}
+
+	// rows of a cv::Mat need not be 4 byte aligned nor contiguous
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, (GLint)(image.step[0] / image.elemSize()));
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image.cols, image.rows, format, GL_UNSIGNED_BYTE, image.data);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+void StreamingTexture::UpdateFromBuffer(const cv::Mat &image, GLenum format) {
+	int slot = next_slot_;
+	next_slot_ = (next_slot_ + 1) % (int)fences_.size();
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload_ == PERSISTENT ? buffers_[0] : buffers_[slot]);
+
+	// a signalled fence means the last glTexSubImage2D from this slot is done
+	bool busy = fences_[slot] && glClientWaitSync(fences_[slot], 0, 0) == GL_TIMEOUT_EXPIRED;
+	if (busy) busy_buffers_++;
+
+	unsigned char *target = NULL;
+	size_t offset = 0;
+	if (upload_ == PERSISTENT) {
+		// part of one big buffer, cannot be orphaned: wait until the GPU is done with it
+		while (busy && glClientWaitSync(fences_[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {
+		}
+		offset = slot * slot_size_;
+		target = mapped_ + offset;
+	} else {
+		// overwrite an idle buffer in place, hand a busy one back to the driver rather than stall
+		GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT;
+		if (busy) glBufferData(GL_PIXEL_UNPACK_BUFFER, image_size_, NULL, GL_STREAM_DRAW);
+		else access |= GL_MAP_UNSYNCHRONIZED_BIT;
+		target = (unsigned char *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, image_size_, access);
+	}
+	if (fences_[slot]) glDeleteSync(fences_[slot]);
+	fences_[slot] = 0;
+
+	if (!target) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		ReleaseBuffers();
+		buffers_.clear();
+		upload_ = DIRECT;
+		std::cout << "streaming texture: mapping failed, using " << Name(upload_) << std::endl;
+		return;
+	}
+
+	size_t row = (size_t)image.cols * image.elemSize();
+	if (image.isContinuous()) std::memcpy(target, image.data, image_size_);
+	else for (int y = 0; y < image.rows; y++) std::memcpy(target + y * row, image.ptr(y), row);
+	if (upload_ == PIXEL_BUFFER) glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image.cols, image.rows, format, GL_UNSIGNED_BYTE, (void *)offset);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	fences_[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void StreamingTexture::Benchmark(cv::Size size, int frames, int buffers) {
+	// two different images so no driver can skip an upload of unchanged data
+	cv::Mat images[2] = { cv::Mat(size, CV_8UC3, cv::Scalar(40, 80, 120)), cv::Mat(size, CV_8UC3, cv::Scalar(200, 160, 120)) };
+	double tick = 1000.0 / cv::getTickFrequency();
+	for (int u = DIRECT; u <= PERSISTENT; u++) {
+		if (u == PERSISTENT && !HasBufferStorage()) {
+			std::cout << "[upload] " << Name((Upload)u) << ": not supported by this context" << std::endl;
+			continue;
+		}
+		StreamingTexture texture((Upload)u, buffers);
+		texture.Update(images[0]);
+		glFinish();
+
+		// pipelined, as in the render loop: CPU time per call and overall time per frame
+		double cpu_sum = 0, cpu_max = 0;
+		int64_t start = cv::getTickCount();
+		for (int i = 0; i < frames; i++) {
+			int64_t call = cv::getTickCount();
+			texture.Update(images[i & 1]);
+			double cpu = (cv::getTickCount() - call) * tick;
+			cpu_sum += cpu;
+			cpu_max = std::max(cpu_max, cpu);
+			glFlush();
+		}
+		glFinish();
+		double throughput = (cv::getTickCount() - start) * tick / frames;
+
+		// latency: from the call until the GPU holds the new texture
+		double latency = 0;
+		for (int i = 0; i < frames; i++) {
+			int64_t call = cv::getTickCount();
+			texture.Update(images[i & 1]);
+			glFinish();
+			latency += (cv::getTickCount() - call) * tick;
+		}
+
+		std::cout << "[upload] " << size.width << "x" << size.height << " " << Name(texture.upload()) << ": cpu avg " << cpu_sum / frames
+			<< " ms max " << cpu_max << " ms, " << throughput << " ms/frame pipelined, latency " << latency / frames << " ms, "
+			<< texture.busy_buffers() << " busy buffers" << std::endl;
+	}
+}
+
+void StreamingTexture::Bind() const {
+	glBindTexture(GL_TEXTURE_2D, texture_);
+}
+
+unsigned int StreamingTexture::id() const {
+	return texture_;
+}
+
+cv::Size StreamingTexture::size() const {
+	return cv::Size(width_, height_);
+}
+
+StreamingTexture::Upload StreamingTexture::upload() const {
+	return upload_;
+}
+
+int StreamingTexture::allocations() const {
+	return allocations_;
+}
+
+int StreamingTexture::busy_buffers() const {
+	return busy_buffers_;
+}